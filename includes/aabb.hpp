@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ray.hpp"
+#include "utils.hpp"
+
+struct AABB {
+    vec3 min{std::numeric_limits<float>::infinity()};
+    vec3 max{-std::numeric_limits<float>::infinity()};
+
+    AABB() = default;
+
+    AABB(const vec3& _min, const vec3& _max) : min{_min}, max{_max} {}
+
+    void grow(const vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void grow(const AABB& other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    vec3 centroid() const {
+        return (min + max) * 0.5f;
+    }
+
+    float area() const {
+        vec3 e = max - min;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    // Slab test, returns the entry distance or infinity on a miss
+    float Hit(const Ray& ray, const vec3& inv_direction, float t_min, float t_max) const {
+        vec3 t0s = (min - ray.origin) * inv_direction;
+        vec3 t1s = (max - ray.origin) * inv_direction;
+
+        vec3 tsmaller = glm::min(t0s, t1s);
+        vec3 tbigger = glm::max(t0s, t1s);
+
+        float tenter = std::max(t_min, std::max(tsmaller.x, std::max(tsmaller.y, tsmaller.z)));
+        float texit = std::min(t_max, std::min(tbigger.x, std::min(tbigger.y, tbigger.z)));
+
+        return tenter <= texit ? tenter : std::numeric_limits<float>::infinity();
+    }
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_io.hpp"
+#include "scene_file.hpp"
+
+// Camera poses of a batch job, one per output frame. Poses between keys are interpolated
+// linearly, a file lists the keys one per line:
+//
+//   key <frame> <from x y z> <at x y z> <vfov>
+//
+// Frames count from 0, keys must be in increasing frame order and the last key ends the job.
+struct CameraPath {
+    struct Key {
+        int frame;
+        scene_file::CameraRecord camera;
+    };
+
+    std::vector<Key> keys;
+
+    int FrameCount() const {
+        return keys.empty() ? 0 : keys.back().frame + 1;
+    }
+
+    // vup is not part of a key, every pose keeps the one of camera
+    bool Load(const std::string& path, const Camera& camera, std::string& error) {
+        std::ifstream file{path};
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        keys.clear();
+        std::string line;
+        int line_number = 0;
+        while (std::getline(file, line)) {
+            line_number++;
+            line = line.substr(0, line.find('#'));
+
+            std::istringstream in{line};
+            std::string keyword;
+            if (!(in >> keyword)) {
+                continue;
+            }
+
+            Key key{0, scene_file::ToRecord(camera)};
+            scene_file::CameraRecord& pose = key.camera;
+            if (keyword != "key" || !(in >> key.frame >> pose.look_from.x >> pose.look_from.y >> pose.look_from.z >> pose.look_at.x >> pose.look_at.y >>
+                                      pose.look_at.z >> pose.vfov)) {
+                error = path + ":" + std::to_string(line_number) + ": expected key <frame> <from x y z> <at x y z> <vfov>";
+                return false;
+            }
+            if (key.frame < 0 || (!keys.empty() && key.frame <= keys.back().frame)) {
+                error = path + ":" + std::to_string(line_number) + ": frames must start at 0 or later and increase";
+                return false;
+            }
+            keys.push_back(key);
+        }
+
+        if (keys.empty()) {
+            error = path + " has no keys";
+            return false;
+        }
+        return true;
+    }
+
+    // frames poses on a full circle around the look at point, about camera's up axis
+    static CameraPath Turntable(const Camera& camera, int frames) {
+        CameraPath path;
+        const vec3 axis = normalize(camera.vup);
+        const vec3 offset = camera.look_from - camera.look_at;
+        for (int frame = 0; frame < frames; frame++) {
+            // Rodrigues' rotation formula
+            const float angle = 2.0f * float(pi) * frame / frames;
+            const float c = std::cos(angle), s = std::sin(angle);
+            const vec3 rotated = offset * c + cross(axis, offset) * s + axis * dot(axis, offset) * (1.0f - c);
+
+            scene_file::CameraRecord pose = scene_file::ToRecord(camera);
+            pose.look_from = camera.look_at + rotated;
+            path.keys.push_back(Key{frame, pose});
+        }
+        return path;
+    }
+
+    scene_file::CameraRecord At(int frame) const {
+        size_t next = 0;
+        while (next + 1 < keys.size() && keys[next].frame < frame) {
+            next++;
+        }
+        if (next == 0 || keys[next].frame <= frame) {
+            return keys[next].camera;
+        }
+
+        const Key& a = keys[next - 1];
+        const Key& b = keys[next];
+        const float t = float(frame - a.frame) / (b.frame - a.frame);
+        scene_file::CameraRecord pose = a.camera;
+        pose.look_from = mix(a.camera.look_from, b.camera.look_from, t);
+        pose.look_at = mix(a.camera.look_at, b.camera.look_at, t);
+        pose.vfov = a.camera.vfov + (b.camera.vfov - a.camera.vfov) * t;
+        return pose;
+    }
+};
+
+// Tonemaps and writes finished frames on a background thread, so tracing the next frame overlaps
+// the encoding and the disk writes of the previous one. At most one frame waits while another is
+// being written, a faster tracer blocks in Submit instead of piling frames up in memory.
+struct FrameWriter {
+    struct Frame {
+        std::string path;
+        std::vector<Color> pixels;
+    };
+
+    int width;
+    int height;
+    bool write_pfm;
+
+    std::atomic<bool> failed = false;
+    std::string error;
+
+    FrameWriter(int _width, int _height, bool _write_pfm) : width{_width}, height{_height}, write_pfm{_write_pfm} {
+        thread = std::thread([this] { Run(); });
+    }
+
+    ~FrameWriter() {
+        Finish();
+    }
+
+    // Copies pixels, path is the output path without extension
+    void Submit(const std::string& path, const std::vector<Color>& pixels) {
+        std::unique_lock lock{mutex};
+        changed.wait(lock, [&] { return queue.size() < max_waiting; });
+
+        Frame frame;
+        if (!spare.empty()) {
+            frame = std::move(spare.back());
+            spare.pop_back();
+        }
+        frame.path = path;
+        frame.pixels.assign(pixels.begin(), pixels.end());
+        queue.push_back(std::move(frame));
+        changed.notify_all();
+    }
+
+    // Waits for every submitted frame to be written
+    void Finish() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+            changed.notify_all();
+        }
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+  private:
+    static constexpr size_t max_waiting = 1;
+
+    std::deque<Frame> queue;
+    // Buffers of written frames, reused so steady state does no allocation
+    std::vector<Frame> spare;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    void Run() {
+        std::vector<Color> tonemapped;
+        while (true) {
+            Frame frame;
+            {
+                std::unique_lock lock{mutex};
+                changed.wait(lock, [&] { return !queue.empty() || stopping; });
+                if (queue.empty()) {
+                    return;
+                }
+                frame = std::move(queue.front());
+                queue.pop_front();
+                changed.notify_all();
+            }
+
+            tonemapped.resize(frame.pixels.size());
+            for (size_t i = 0; i < frame.pixels.size(); i++) {
+                tonemapped[i] = gamma_encode(frame.pixels[i]);
+            }
+
+            const std::string ppm_path = frame.path + ".ppm";
+            const std::string pfm_path = frame.path + ".pfm";
+            const bool ok = WritePPM(ppm_path, width, height, tonemapped) && (!write_pfm || WritePFM(pfm_path, width, height, frame.pixels));
+
+            std::lock_guard lock{mutex};
+            if (!ok && !failed) {
+                error = "failed to write " + frame.path;
+                failed = true;
+            }
+            spare.push_back(std::move(frame));
+        }
+    }
+};
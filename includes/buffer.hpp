@@ -0,0 +1,125 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+// Array that either owns its elements or views memory owned by someone else, like a mapped
+// scene file. Const access never copies; the first mutating call copies a view into owned
+// storage, so loaded data can still be edited or rebuilt.
+template <typename T>
+struct Buffer {
+    Buffer() = default;
+
+    Buffer(std::vector<T> elements) : storage{std::move(elements)} {}
+
+    Buffer& operator=(std::vector<T> elements) {
+        Release();
+        storage = std::move(elements);
+        return *this;
+    }
+
+    // keep_alive owns the memory behind ptr for as long as the view exists
+    void Map(const T* ptr, size_t count, std::shared_ptr<const void> keep_alive) {
+        storage.clear();
+        storage.shrink_to_fit();
+        view = ptr;
+        view_size = count;
+        owner = std::move(keep_alive);
+    }
+
+    bool mapped() const {
+        return view != nullptr;
+    }
+
+    const T* data() const {
+        return view ? view : storage.data();
+    }
+
+    size_t size() const {
+        return view ? view_size : storage.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T& operator[](size_t i) const {
+        return data()[i];
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return begin() + size();
+    }
+
+    T* data() {
+        return Owned().data();
+    }
+
+    T& operator[](size_t i) {
+        return Owned()[i];
+    }
+
+    T* begin() {
+        return Owned().data();
+    }
+
+    // size() is the same before and after begin() copies a view, so the order the operands are
+    // evaluated in does not matter
+    T* end() {
+        return begin() + size();
+    }
+
+    T& back() {
+        return Owned().back();
+    }
+
+    void push_back(const T& value) {
+        Owned().push_back(value);
+    }
+
+    void resize(size_t count) {
+        Owned().resize(count);
+    }
+
+    void assign(size_t count, const T& value) {
+        Release();
+        storage.assign(count, value);
+    }
+
+    void reserve(size_t count) {
+        Owned().reserve(count);
+    }
+
+    void clear() {
+        Release();
+        storage.clear();
+    }
+
+    void shrink_to_fit() {
+        Owned().shrink_to_fit();
+    }
+
+  private:
+    std::vector<T> storage;
+    const T* view = nullptr;
+    size_t view_size = 0;
+    std::shared_ptr<const void> owner;
+
+    std::vector<T>& Owned() {
+        if (view) {
+            storage.assign(view, view + view_size);
+            Release();
+        }
+        return storage;
+    }
+
+    void Release() {
+        view = nullptr;
+        view_size = 0;
+        owner.reset();
+    }
+};
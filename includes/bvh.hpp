@@ -0,0 +1,359 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "aabb.hpp"
+#include "buffer.hpp"
+#include "packet.hpp"
+#include "ray.hpp"
+
+// Interior nodes store the index of their left child, the right child always follows it.
+// Leaves store the first entry into BVH::indices and a non zero primitive count.
+struct BVHNode {
+    AABB bounds;
+    uint32_t left_first;
+    uint32_t count;
+
+    bool is_leaf() const {
+        return count > 0;
+    }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode should stay two nodes per cache line");
+
+struct BVH {
+    static constexpr int bin_count = 16;
+    static constexpr uint32_t max_leaf_size = 8;
+    static constexpr float traversal_cost = 1.0f;
+    static constexpr float intersection_cost = 1.0f;
+    // Traversal keeps at most one pending node per level on a fixed stack, deeper splits are
+    // left as leaves
+    static constexpr int max_depth = 60;
+    static constexpr int stack_capacity = 64;
+    static_assert(max_depth < stack_capacity, "traversal stack must hold one entry per level");
+    // Packet traversal pushes both children, one more entry than a level's share
+    static_assert(max_depth + 1 < stack_capacity, "packet traversal stack must hold one entry per level and a sibling pair");
+
+    Buffer<BVHNode> nodes;
+    Buffer<uint32_t> indices;
+
+    BVH() = default;
+
+    void Build(const std::vector<AABB>& prim_bounds) {
+        nodes.clear();
+        indices.resize(prim_bounds.size());
+        std::iota(indices.begin(), indices.end(), 0);
+
+        if (prim_bounds.empty()) {
+            return;
+        }
+
+        centroids.resize(prim_bounds.size());
+        for (size_t i = 0; i < prim_bounds.size(); i++) {
+            centroids[i] = prim_bounds[i].centroid();
+        }
+
+        nodes.reserve(prim_bounds.size() * 2 - 1);
+        nodes.push_back(BVHNode{AABB{}, 0, uint32_t(prim_bounds.size())});
+        UpdateBounds(0, prim_bounds);
+        Subdivide(0, prim_bounds, 0);
+
+        nodes.shrink_to_fit();
+        centroids.clear();
+        centroids.shrink_to_fit();
+    }
+
+    // Recomputes the node bounds for moved primitives while keeping the topology. Children always
+    // come after their parent, so walking the nodes backwards visits them bottom up.
+    void Refit(const std::vector<AABB>& prim_bounds) {
+        for (size_t i = nodes.size(); i-- > 0;) {
+            BVHNode& node = nodes[i];
+            AABB bounds;
+            if (node.is_leaf()) {
+                for (uint32_t j = 0; j < node.count; j++) {
+                    bounds.grow(prim_bounds[indices[node.left_first + j]]);
+                }
+            } else {
+                bounds.grow(nodes[node.left_first].bounds);
+                bounds.grow(nodes[node.left_first + 1].bounds);
+            }
+            node.bounds = bounds;
+        }
+    }
+
+    // Expected cost of a random ray through the root, grows as refits stretch the nodes
+    float SAHCost() const {
+        if (nodes.empty() || nodes[0].bounds.area() <= 0.0f) {
+            return 0.0f;
+        }
+
+        float cost = 0.0f;
+        for (const BVHNode& node : nodes) {
+            cost += node.bounds.area() * (node.is_leaf() ? intersection_cost * node.count : traversal_cost);
+        }
+        return cost / nodes[0].bounds.area();
+    }
+
+    // Calls intersect(prim_index, closest) for every primitive in a leaf the ray reaches,
+    // the callback returns true and shrinks closest when it finds a nearer hit.
+    template <typename Intersect>
+    bool Traverse(const Ray& ray, float t_min, float& closest, Intersect&& intersect) const {
+        return TraverseLeaves(ray, t_min, closest, [&](const BVHNode& leaf, float& closest_so_far) {
+            bool hit = false;
+            for (uint32_t i = 0; i < leaf.count; i++) {
+                if (intersect(indices[leaf.left_first + i], closest_so_far)) {
+                    hit = true;
+                }
+            }
+            return hit;
+        });
+    }
+
+    // Same as Traverse but hands whole leaves to the callback, for batched primitive tests
+    template <typename IntersectLeaf>
+    bool TraverseLeaves(const Ray& ray, float t_min, float& closest, IntersectLeaf&& intersect_leaf) const {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const vec3& inv_direction = ray.inv_direction;
+        std::array<uint32_t, stack_capacity> stack;
+        int stack_size = 0;
+        uint32_t node_idx = 0;
+        bool hit_anything = false;
+
+        if (nodes[0].bounds.Hit(ray, inv_direction, t_min, closest) == std::numeric_limits<float>::infinity()) {
+            return false;
+        }
+
+        while (true) {
+            const BVHNode& node = nodes[node_idx];
+
+            if (node.is_leaf()) {
+                if (intersect_leaf(node, closest)) {
+                    hit_anything = true;
+                }
+            } else {
+                uint32_t near_idx = node.left_first;
+                uint32_t far_idx = node.left_first + 1;
+                float near_t = nodes[near_idx].bounds.Hit(ray, inv_direction, t_min, closest);
+                float far_t = nodes[far_idx].bounds.Hit(ray, inv_direction, t_min, closest);
+
+                if (far_t < near_t) {
+                    std::swap(near_idx, far_idx);
+                    std::swap(near_t, far_t);
+                }
+
+                if (near_t != std::numeric_limits<float>::infinity()) {
+                    if (far_t != std::numeric_limits<float>::infinity()) {
+                        stack[stack_size++] = far_idx;
+                    }
+                    node_idx = near_idx;
+                    continue;
+                }
+            }
+
+            // Pop the next node that is still closer than the current hit
+            bool found = false;
+            while (stack_size > 0) {
+                node_idx = stack[--stack_size];
+                if (nodes[node_idx].bounds.Hit(ray, inv_direction, t_min, closest) != std::numeric_limits<float>::infinity()) {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) {
+                break;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Packet version of TraverseLeaves. A node is tested from the first ray group that reached
+    // its parent on, rays before it are known to miss. intersect_leaf(leaf, ray) is called for
+    // every ray of the packet that reaches a leaf and returns true when it shrank the ray's closest.
+    template <typename IntersectLeaf>
+    void TraversePacketLeaves(RayPacket& packet, float t_min, IntersectLeaf&& intersect_leaf) const {
+        if (nodes.empty() || packet.size == 0) {
+            return;
+        }
+
+        struct Entry {
+            uint32_t node;
+            int first_group;
+        };
+        std::array<Entry, stack_capacity> stack;
+        int stack_size = 0;
+        stack[stack_size++] = Entry{0, 0};
+
+        const int groups = packet.groups();
+        float max_closest = packet.MaxClosest();
+
+        while (stack_size > 0) {
+            const Entry entry = stack[--stack_size];
+            const BVHNode& node = nodes[entry.node];
+            if (packet.Culled(node.bounds, t_min, max_closest)) {
+                continue;
+            }
+
+            int group = entry.first_group;
+            unsigned mask = 0;
+            while (group < groups && !(mask = packet.GroupHit(group, node.bounds, t_min))) {
+                group++;
+            }
+            if (!mask) {
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                bool hit = false;
+                for (int g = group; g < groups; g++) {
+                    for (unsigned lanes = g == group ? mask : packet.GroupHit(g, node.bounds, t_min); lanes; lanes &= lanes - 1) {
+                        hit |= intersect_leaf(node, g * simd_width + __builtin_ctz(lanes));
+                    }
+                }
+                if (hit) {
+                    max_closest = packet.MaxClosest();
+                }
+                continue;
+            }
+
+            // Visit the child nearer along the first ray that reached this node first
+            const Ray& ray = packet.rays[group * simd_width + __builtin_ctz(mask)];
+            uint32_t near_idx = node.left_first;
+            uint32_t far_idx = node.left_first + 1;
+            if (dot(nodes[far_idx].bounds.centroid() - nodes[near_idx].bounds.centroid(), ray.direction) < 0.0f) {
+                std::swap(near_idx, far_idx);
+            }
+            stack[stack_size++] = Entry{far_idx, group};
+            stack[stack_size++] = Entry{near_idx, group};
+        }
+    }
+
+  private:
+    std::vector<vec3> centroids;
+
+    void UpdateBounds(uint32_t node_idx, const std::vector<AABB>& prim_bounds) {
+        BVHNode& node = nodes[node_idx];
+        node.bounds = AABB{};
+        for (uint32_t i = 0; i < node.count; i++) {
+            node.bounds.grow(prim_bounds[indices[node.left_first + i]]);
+        }
+    }
+
+    // Binned SAH, returns the split cost or infinity when no split separates the centroids
+    float FindBestSplit(const BVHNode& node, const std::vector<AABB>& prim_bounds, int& best_axis, float& best_pos) const {
+        AABB centroid_bounds;
+        for (uint32_t i = 0; i < node.count; i++) {
+            centroid_bounds.grow(centroids[indices[node.left_first + i]]);
+        }
+
+        float best_cost = std::numeric_limits<float>::infinity();
+
+        for (int axis = 0; axis < 3; axis++) {
+            float bounds_min = centroid_bounds.min[axis];
+            float bounds_max = centroid_bounds.max[axis];
+            if (bounds_min == bounds_max) {
+                continue;
+            }
+
+            struct Bin {
+                AABB bounds;
+                uint32_t count = 0;
+            };
+
+            std::array<Bin, bin_count> bins;
+            float scale = bin_count / (bounds_max - bounds_min);
+
+            for (uint32_t i = 0; i < node.count; i++) {
+                uint32_t prim = indices[node.left_first + i];
+                int bin = std::min(bin_count - 1, int((centroids[prim][axis] - bounds_min) * scale));
+                bins[bin].count++;
+                bins[bin].bounds.grow(prim_bounds[prim]);
+            }
+
+            // Sweep from both sides to get the area and count left and right of every plane
+            std::array<float, bin_count - 1> left_area, right_area;
+            std::array<uint32_t, bin_count - 1> left_count, right_count;
+            AABB left_box, right_box;
+            uint32_t left_sum = 0, right_sum = 0;
+
+            for (int i = 0; i < bin_count - 1; i++) {
+                left_sum += bins[i].count;
+                left_count[i] = left_sum;
+                left_box.grow(bins[i].bounds);
+                left_area[i] = left_box.area();
+
+                right_sum += bins[bin_count - 1 - i].count;
+                right_count[bin_count - 2 - i] = right_sum;
+                right_box.grow(bins[bin_count - 1 - i].bounds);
+                right_area[bin_count - 2 - i] = right_box.area();
+            }
+
+            for (int i = 0; i < bin_count - 1; i++) {
+                if (left_count[i] == 0 || right_count[i] == 0) {
+                    continue;
+                }
+
+                float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_pos = bounds_min + (i + 1) / scale;
+                }
+            }
+        }
+
+        return best_cost;
+    }
+
+    void Subdivide(uint32_t node_idx, const std::vector<AABB>& prim_bounds, int depth) {
+        BVHNode& node = nodes[node_idx];
+        if (node.count <= 1 || depth >= max_depth) {
+            return;
+        }
+
+        int axis = 0;
+        float split_pos = 0.0f;
+        float split_cost = traversal_cost + intersection_cost * FindBestSplit(node, prim_bounds, axis, split_pos) / node.bounds.area();
+        float leaf_cost = intersection_cost * node.count;
+
+        if (split_cost == std::numeric_limits<float>::infinity() || (split_cost >= leaf_cost && node.count <= max_leaf_size)) {
+            return;
+        }
+
+        // Partition the primitive indices around the split plane
+        int i = node.left_first;
+        int j = i + node.count - 1;
+        while (i <= j) {
+            if (centroids[indices[i]][axis] < split_pos) {
+                i++;
+            } else {
+                std::swap(indices[i], indices[j--]);
+            }
+        }
+
+        uint32_t left_count = i - node.left_first;
+        if (left_count == 0 || left_count == node.count) {
+            return;
+        }
+
+        uint32_t left_idx = nodes.size();
+        nodes.push_back(BVHNode{AABB{}, node.left_first, left_count});
+        nodes.push_back(BVHNode{AABB{}, uint32_t(i), nodes[node_idx].count - left_count});
+
+        // push_back may have reallocated, so do not reuse the node reference from here
+        nodes[node_idx].left_first = left_idx;
+        nodes[node_idx].count = 0;
+
+        UpdateBounds(left_idx, prim_bounds);
+        UpdateBounds(left_idx + 1, prim_bounds);
+        Subdivide(left_idx, prim_bounds, depth + 1);
+        Subdivide(left_idx + 1, prim_bounds, depth + 1);
+    }
+};
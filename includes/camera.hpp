@@ -44,4 +44,23 @@ struct Camera {
     Ray get_ray(float s, float t) const {
         return Ray(origin, lower_left_corner + s * horizontal + t * vertical - origin);
     }
+
+    bool same_view(const Camera& other) const {
+        return origin == other.origin && lower_left_corner == other.lower_left_corner && horizontal == other.horizontal && vertical == other.vertical;
+    }
+
+    // Inverse of get_ray: the image coordinates a world point is seen at and its distance in units
+    // of the get_ray direction, false when it lies behind the camera or outside the image
+    bool project(const vec3& point, vec2& st, float& t) const {
+        const vec3 forward = lower_left_corner + 0.5f * horizontal + 0.5f * vertical - origin;
+        const vec3 offset = point - origin;
+        t = dot(offset, forward) / dot(forward, forward);
+        if (t <= 0.0f) {
+            return false;
+        }
+
+        const vec3 on_plane = offset / t - (lower_left_corner - origin);
+        st = vec2{dot(on_plane, horizontal) / dot(horizontal, horizontal), dot(on_plane, vertical) / dot(vertical, vertical)};
+        return st.x >= 0.0f && st.x < 1.0f && st.y >= 0.0f && st.y < 1.0f;
+    }
 };
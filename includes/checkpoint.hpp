@@ -0,0 +1,309 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_io.hpp"
+#include "scene_file.hpp"
+#include "tracer.hpp"
+
+// Everything a progressive render needs to continue exactly where it stopped. Samplers derive
+// their state from the pixel, the sample index and the seed, so the per tile sample counts stand in
+// for the sampler state. The file is the header followed by the arrays in the order below, raw.
+namespace checkpoint {
+
+constexpr char magic[8] = {'P', 'T', 'C', 'H', 'E', 'C', 'K', '\0'};
+constexpr uint32_t version = 1;
+constexpr uint32_t endian_tag = 0x01020304;
+// Anything larger is taken for a corrupt header
+constexpr int32_t max_dimension = 1 << 16;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    int32_t width;
+    int32_t height;
+    int32_t samples;
+    uint32_t seed;
+    uint8_t sampler;
+    uint8_t integrator;
+    uint8_t next_event;
+    uint8_t russian_roulette;
+    int32_t max_depth;
+    int32_t roulette_depth;
+    uint8_t adaptive;
+    uint8_t features;
+    uint8_t reserved[2];
+    float adaptive_threshold;
+    int32_t adaptive_min_samples;
+    float luminance_offset;
+    int32_t grid_x;
+    int32_t grid_y;
+    int32_t grid_tile_size;
+    scene_file::CameraRecord camera;
+    // Guards against resuming with another scene
+    uint64_t scene_hash;
+    PathCounters total;
+};
+
+// FNV-1a over the object bounds and materials, and the environment when there is one
+template <typename World>
+uint64_t SceneHash(const World& world) {
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+
+    for (uint32_t i = 0; i < world.ObjectCount(); i++) {
+        const AABB& bounds = world.object_bounds[i];
+        add(&bounds.min, sizeof(bounds.min));
+        add(&bounds.max, sizeof(bounds.max));
+
+        scene_file::MaterialRecord material{};
+        if (world.VisitMaterial(world.MaterialOf(i), [&](const auto& mat) { return scene_file::ToRecord(mat, material); })) {
+            add(&material.type, sizeof(material.type));
+            add(&material.color, sizeof(material.color));
+            add(&material.ior, sizeof(material.ior));
+        }
+    }
+
+    const Environment& environment = world.environment;
+    if (!environment.empty()) {
+        add(&environment.width, sizeof(environment.width));
+        add(&environment.height, sizeof(environment.height));
+        add(&environment.intensity, sizeof(environment.intensity));
+        add(&environment.rotation, sizeof(environment.rotation));
+        add(environment.pixels.data(), environment.pixels.size() * sizeof(Color));
+    }
+    return hash;
+}
+
+}  // namespace checkpoint
+
+struct Checkpoint {
+    checkpoint::Header header{};
+    std::vector<Color> pixels;
+    std::vector<Tracer::LuminanceMoments> variance;
+    std::vector<float> pixel_depth;
+    std::vector<uint32_t> tile_samples;
+    std::vector<float> tile_errors;
+    // Only present while the render accumulates denoiser features
+    std::vector<Color> feature_albedo;
+    std::vector<vec3> feature_normal;
+
+    // Copies the tracer's accumulation state, only call between frames
+    void Capture(const Tracer& tracer) {
+        std::memcpy(header.magic, checkpoint::magic, sizeof(checkpoint::magic));
+        header.version = checkpoint::version;
+        header.endian = checkpoint::endian_tag;
+        header.width = tracer.texture_size.x;
+        header.height = tracer.texture_size.y;
+        header.samples = tracer.samples;
+        header.seed = tracer.seed;
+        header.sampler = uint8_t(tracer.sampler_type);
+        header.integrator = uint8_t(tracer.integrator);
+        header.next_event = tracer.settings.next_event;
+        header.russian_roulette = tracer.settings.russian_roulette;
+        header.max_depth = tracer.settings.max_depth;
+        header.roulette_depth = tracer.settings.roulette_depth;
+        header.adaptive = tracer.adaptive.enabled;
+        header.features = tracer.denoise.enabled;
+        header.adaptive_threshold = tracer.adaptive.threshold;
+        header.adaptive_min_samples = tracer.adaptive.min_samples;
+        header.luminance_offset = tracer.adaptive.luminance_offset;
+        header.grid_x = tracer.tile_grid.x;
+        header.grid_y = tracer.tile_grid.y;
+        header.grid_tile_size = tracer.grid_tile_size;
+        header.camera = scene_file::ToRecord(tracer.camera);
+        header.scene_hash = checkpoint::SceneHash(tracer.world);
+        header.total = tracer.total;
+
+        pixels = tracer.pixels;
+        variance = tracer.variance;
+        pixel_depth = tracer.pixel_depth;
+        tile_samples = tracer.tile_samples;
+        tile_errors = tracer.tile_errors;
+        feature_albedo = header.features ? tracer.feature_albedo : std::vector<Color>{};
+        feature_normal = header.features ? tracer.feature_normal : std::vector<vec3>{};
+    }
+
+    // Writes next to path, syncs and renames, so a crash or power loss mid write leaves the previous
+    // checkpoint intact
+    bool Write(const std::string& path, std::string& error) const {
+        const std::string temporary = path + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file) {
+            error = "cannot create " + temporary;
+            return false;
+        }
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && WriteArray(file, pixels) && WriteArray(file, variance) && WriteArray(file, pixel_depth);
+        ok = ok && WriteArray(file, tile_samples) && WriteArray(file, tile_errors);
+        ok = ok && WriteArray(file, feature_albedo) && WriteArray(file, feature_normal);
+        ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+
+        if (std::fclose(file) != 0 || !ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            error = "failed to write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    bool Read(const std::string& path, std::string& error) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1;
+        if (!ok || std::memcmp(header.magic, checkpoint::magic, sizeof(checkpoint::magic)) != 0 || header.version != checkpoint::version ||
+            header.endian != checkpoint::endian_tag) {
+            std::fclose(file);
+            error = path + " is not a checkpoint of this version";
+            return false;
+        }
+
+        // The tile grid has to be the one the tracer would lay over this image, or none yet
+        const int tile = header.grid_tile_size;
+        const bool grid_ok = tile > 0 ? header.grid_x == (header.width + tile - 1) / tile && header.grid_y == (header.height + tile - 1) / tile
+                                      : tile == 0 && header.grid_x == 0 && header.grid_y == 0;
+        if (header.width <= 0 || header.height <= 0 || header.width > checkpoint::max_dimension || header.height > checkpoint::max_dimension ||
+            !grid_ok || header.sampler > uint8_t(SamplerType::Sobol) || header.integrator > uint8_t(Integrator::Wavefront)) {
+            std::fclose(file);
+            error = path + " has an inconsistent header";
+            return false;
+        }
+
+        const size_t pixel_count = size_t(header.width) * header.height;
+        const size_t tile_count = size_t(header.grid_x) * header.grid_y;
+        const size_t feature_count = header.features ? pixel_count : 0;
+
+        // The arrays are sized from the header, which must not allocate more than the file holds
+        const uint64_t payload = pixel_count * (sizeof(Color) + sizeof(Tracer::LuminanceMoments) + sizeof(float)) +
+                                 tile_count * (sizeof(uint32_t) + sizeof(float)) + feature_count * (sizeof(Color) + sizeof(vec3));
+        uint64_t remaining;
+        if (!RemainingBytes(file, remaining) || remaining != payload) {
+            std::fclose(file);
+            error = path + " is truncated";
+            return false;
+        }
+
+        ok = ReadArray(file, pixels, pixel_count) && ReadArray(file, variance, pixel_count) && ReadArray(file, pixel_depth, pixel_count);
+        ok = ok && ReadArray(file, tile_samples, tile_count) && ReadArray(file, tile_errors, tile_count);
+        ok = ok && ReadArray(file, feature_albedo, feature_count) && ReadArray(file, feature_normal, feature_count);
+        std::fclose(file);
+
+        if (!ok) {
+            error = path + " is truncated";
+            return false;
+        }
+        return true;
+    }
+
+    // The checkpoint decides everything that shapes the image, the tracer's scene has to match
+    bool Restore(Tracer& tracer, std::string& error) const {
+        if (header.scene_hash != checkpoint::SceneHash(tracer.world)) {
+            error = "the checkpoint was rendered from a different scene";
+            return false;
+        }
+
+        tracer.camera = Camera{float(header.width) / header.height};
+        scene_file::FromRecord(header.camera, tracer.camera);
+        tracer.camera.UpdateVectors();
+        tracer.seed = header.seed;
+        tracer.sampler_type = SamplerType(header.sampler);
+        tracer.integrator = Integrator(header.integrator);
+        tracer.settings.next_event = header.next_event;
+        tracer.settings.russian_roulette = header.russian_roulette;
+        tracer.settings.max_depth = header.max_depth;
+        tracer.settings.roulette_depth = header.roulette_depth;
+        tracer.adaptive.enabled = header.adaptive;
+        tracer.adaptive.threshold = header.adaptive_threshold;
+        tracer.adaptive.min_samples = header.adaptive_min_samples;
+        tracer.adaptive.luminance_offset = header.luminance_offset;
+        tracer.denoise.enabled = header.features;
+
+        tracer.Resize(header.width, header.height);
+        // The running means only continue correctly on the grid they were sampled on
+        tracer.tile_size = header.grid_tile_size > 0 ? header.grid_tile_size : tracer.tile_size;
+        tracer.tile_grid = {header.grid_x, header.grid_y};
+        tracer.grid_tile_size = header.grid_tile_size;
+        tracer.tile_samples = tile_samples;
+        tracer.tile_errors = tile_errors;
+        tracer.pixels = pixels;
+        tracer.variance = variance;
+        tracer.pixel_depth = pixel_depth;
+        if (header.features) {
+            tracer.feature_albedo = feature_albedo;
+            tracer.feature_normal = feature_normal;
+        }
+        tracer.samples = header.samples;
+        tracer.total = header.total;
+        tracer.last_camera = tracer.camera;
+        return true;
+    }
+
+  private:
+    template <typename T>
+    static bool WriteArray(FILE* file, const std::vector<T>& array) {
+        return std::fwrite(array.data(), sizeof(T), array.size(), file) == array.size();
+    }
+
+    template <typename T>
+    static bool ReadArray(FILE* file, std::vector<T>& array, size_t count) {
+        array.resize(count);
+        return std::fread(array.data(), sizeof(T), count, file) == count;
+    }
+};
+
+// Writes checkpoints on a background thread. Capturing copies the buffers, which takes a fraction
+// of a frame, the disk write overlaps the following frames. A checkpoint that comes due while the
+// previous one is still being written is skipped rather than waited for.
+struct CheckpointWriter {
+    std::string path;
+    Checkpoint pending;
+    std::thread thread;
+    std::atomic<bool> busy = false;
+    std::atomic<bool> failed = false;
+    std::string error;
+
+    ~CheckpointWriter() {
+        Wait();
+    }
+
+    bool Start(const Tracer& tracer) {
+        if (busy) {
+            return false;
+        }
+        Wait();
+
+        pending.Capture(tracer);
+        busy = true;
+        thread = std::thread([this] {
+            if (!pending.Write(path, error)) {
+                failed = true;
+            }
+            busy = false;
+        });
+        return true;
+    }
+
+    void Wait() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+};
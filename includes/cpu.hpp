@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+// Runtime instruction set selection. The build targets a baseline (SSE2 on x86-64 unless the
+// compiler flags say otherwise), the hot kernels also come in AVX2 and AVX-512 versions that are
+// picked once at startup from what the CPU supports. RAYTRACER_ISA or --isa override the pick, for
+// A/B runs on one machine.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__)) && !defined(RAYTRACER_NO_DISPATCH)
+#define RAYTRACER_MULTIVERSION 1
+#define RAYTRACER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define RAYTRACER_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx2,fma")))
+#else
+#define RAYTRACER_MULTIVERSION 0
+#define RAYTRACER_TARGET_AVX2
+#define RAYTRACER_TARGET_AVX512
+#endif
+
+// Ordered by capability, every level can run the kernels of the ones before it
+enum class Isa {
+    Baseline,
+    Avx2,
+    Avx512,
+};
+
+namespace cpu {
+
+inline Isa isa = Isa::Baseline;
+
+inline const char* isa_name(Isa level) {
+    switch (level) {
+        case Isa::Baseline: return "baseline";
+        case Isa::Avx2: return "avx2";
+        case Isa::Avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+// Best level this CPU and OS support, CPUID checks included OS support for the wider registers
+inline Isa detect() {
+#if RAYTRACER_MULTIVERSION
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa::Avx2;
+    }
+#endif
+    return Isa::Baseline;
+}
+
+// Sets isa from requested, or from RAYTRACER_ISA when requested is empty. "auto" and no request at
+// all pick the best supported level, asking for one the CPU lacks is an error.
+inline bool select_isa(std::string requested, std::string& error) {
+    if (requested.empty()) {
+        const char* env = std::getenv("RAYTRACER_ISA");
+        requested = env ? env : "auto";
+    }
+
+    const Isa best = detect();
+    if (requested == "auto") {
+        isa = best;
+        return true;
+    }
+
+    for (Isa level : {Isa::Baseline, Isa::Avx2, Isa::Avx512}) {
+        if (requested != isa_name(level)) {
+            continue;
+        }
+        if (level > best) {
+            error = std::string{"this CPU does not support "} + isa_name(level) + ", the best it runs is " + isa_name(best);
+            return false;
+        }
+        isa = level;
+        return true;
+    }
+
+    error = "unknown instruction set " + requested + ", expected auto, baseline, avx2 or avx512";
+    return false;
+}
+
+#if RAYTRACER_MULTIVERSION
+// flatten inlines f and everything it calls into the clone, so the whole call tree is compiled
+// for the clone's instruction set
+template <typename F>
+RAYTRACER_TARGET_AVX2 __attribute__((flatten)) void run_avx2(F& f) {
+    f();
+}
+
+template <typename F>
+RAYTRACER_TARGET_AVX512 __attribute__((flatten)) void run_avx512(F& f) {
+    f();
+}
+#endif
+
+// Runs f compiled for the selected level. Meant for coarse units of work such as a tile, every
+// function f reaches is duplicated per level.
+template <typename F>
+void dispatch(F&& f) {
+#if RAYTRACER_MULTIVERSION
+    switch (isa) {
+        case Isa::Avx512: run_avx512(f); return;
+        case Isa::Avx2: run_avx2(f); return;
+        case Isa::Baseline: break;
+    }
+#endif
+    f();
+}
+
+}  // namespace cpu
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+struct DenoiseSettings {
+    bool enabled = false;
+    int iterations = 5;
+    // Larger values blur more across differences in brightness, normals and depth
+    float sigma_luminance = 16.0f;
+    float normal_weight = 64.0f;
+    float sigma_depth = 4.0f;
+
+    bool operator==(const DenoiseSettings&) const = default;
+};
+
+// Edge-avoiding a-trous wavelet filter guided by first hit features (Dammertz et al. 2010), with
+// the variance driven luminance weight of SVGF (Schied et al. 2017).
+//
+// The lighting is demodulated, divided by the surface albedo, so the filter smooths noise without
+// smearing texture and color edges, and the albedo is multiplied back in afterwards. Each iteration
+// applies a 5x5 B3 spline kernel whose taps are spread 2^i pixels apart, weighted by how similar
+// every tap's luminance, normal and depth are to the center pixel. The luminance tolerance scales
+// with the noise estimated around the pixel, and that estimate is filtered along with the color, so
+// converged pixels are left alone.
+//
+// All planes share a padded row layout. The border is wide enough for the largest step, its pixels
+// have a valid weight of 0, so the kernel loops need no bounds checks and run a register of
+// pixels at a time.
+struct Denoiser {
+    static constexpr int max_iterations = 5;
+    static constexpr int border = 2 << (max_iterations - 1);
+
+    ivec2 size{0, 0};
+    int stride = 0;
+    // Set the last iteration wrote to
+    int output = 0;
+
+    // Filtered in place, ping-ponging between the two sets
+    aligned_vector<float> red[2], green[2], blue[2], variance[2];
+    // Fixed guides
+    aligned_vector<float> normal_x, normal_y, normal_z, depth, depth_gradient, valid;
+    std::vector<Color> albedo;
+
+    void Resize(ivec2 image_size) {
+        if (image_size == size) {
+            return;
+        }
+        size = image_size;
+        stride = (size.x + 2 * border + 2 * simd_width - 1) / simd_width * simd_width;
+
+        const size_t count = size_t(stride) * (size.y + 2 * border);
+        for (int i = 0; i < 2; i++) {
+            red[i].assign(count, 0.0f);
+            green[i].assign(count, 0.0f);
+            blue[i].assign(count, 0.0f);
+            variance[i].assign(count, 0.0f);
+        }
+        normal_x.assign(count, 0.0f);
+        normal_y.assign(count, 0.0f);
+        normal_z.assign(count, 0.0f);
+        depth.assign(count, 0.0f);
+        depth_gradient.assign(count, 0.0f);
+        valid.assign(count, 0.0f);
+        albedo.assign(size_t(size.x) * size.y, Color{1.0f});
+    }
+
+    size_t Index(int x, int y) const {
+        return size_t(y + border) * stride + x + border;
+    }
+
+    // luminance_variance is the variance of the pixel's mean luminance, escaped rays have an
+    // infinite distance and a zero normal and albedo
+    void Set(int x, int y, const Color& color, float luminance_variance, const Color& surface_albedo, const vec3& normal, float distance) {
+        const size_t i = Index(x, y);
+        // Dark or missing albedo would blow the lighting up, such pixels are filtered as they are
+        auto usable = [](float channel) { return channel > 0.01f ? channel : 1.0f; };
+        const Color demodulate{usable(surface_albedo.r), usable(surface_albedo.g), usable(surface_albedo.b)};
+        const Color lighting = color / demodulate;
+        const float albedo_luminance = std::max(luminance(demodulate), 0.01f);
+
+        red[0][i] = lighting.r;
+        green[0][i] = lighting.g;
+        blue[0][i] = lighting.b;
+        variance[0][i] = luminance_variance / (albedo_luminance * albedo_luminance);
+        normal_x[i] = normal.x;
+        normal_y[i] = normal.y;
+        normal_z[i] = normal.z;
+        // Background pixels only need to agree with each other
+        depth[i] = std::isfinite(distance) ? distance : 1e6f;
+        valid[i] = 1.0f;
+        albedo[size_t(y) * size.x + x] = demodulate;
+    }
+
+    Color Get(int x, int y) const {
+        const size_t i = Index(x, y);
+        return Color{red[output][i], green[output][i], blue[output][i]} * albedo[size_t(y) * size.x + x];
+    }
+
+    void Filter(ThreadPool& pool, const DenoiseSettings& settings) {
+        // How far depth changes between neighbors, the smaller one sided difference keeps
+        // silhouettes from making their pixels accept everything
+        pool.ParallelFor(size.y, [&](uint32_t y, unsigned) {
+            for (int x = 0; x < size.x; x++) {
+                const size_t i = Index(x, y);
+                const float z = depth[i];
+                const float dx = std::min(std::abs(depth[i + 1] - z), std::abs(z - depth[i - 1]));
+                const float dy = std::min(std::abs(depth[i + stride] - z), std::abs(z - depth[i - stride]));
+                depth_gradient[i] = std::max(dx, dy);
+            }
+        });
+
+        const int iterations = std::clamp(settings.iterations, 0, max_iterations);
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            const int in = iteration % 2;
+            pool.ParallelFor(size.y, [&](uint32_t y, unsigned) { FilterRow(y, 1 << iteration, in, settings); });
+        }
+        output = iterations % 2;
+    }
+
+  private:
+    void FilterRow(int y, int step, int in, const DenoiseSettings& settings) {
+        static constexpr float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+        const int out = 1 - in;
+        FlushDenormals flush;
+
+        const vfloat epsilon = vfloat::broadcast(1e-6f);
+        const vfloat sigma_luminance = vfloat::broadcast(settings.sigma_luminance);
+        const vfloat normal_weight = vfloat::broadcast(settings.normal_weight);
+        const vfloat sigma_depth = vfloat::broadcast(settings.sigma_depth * step);
+        const vfloat luma_r = vfloat::broadcast(0.2126f), luma_g = vfloat::broadcast(0.7152f), luma_b = vfloat::broadcast(0.0722f);
+
+        for (int x = 0; x < size.x; x += simd_width) {
+            const size_t p = Index(x, y);
+            const vfloat r = vfloat::load(&red[in][p]), g = vfloat::load(&green[in][p]), b = vfloat::load(&blue[in][p]);
+            const vfloat nx = vfloat::load(&normal_x[p]), ny = vfloat::load(&normal_y[p]), nz = vfloat::load(&normal_z[p]);
+            const vfloat z = vfloat::load(&depth[p]);
+            const vfloat l = r * luma_r + g * luma_g + b * luma_b;
+
+            // A pixel whose few samples happened to agree has no variance of its own, the 3x3
+            // neighborhood gives a steadier estimate
+            vfloat local_variance = vfloat::broadcast(0.0f);
+            for (int ky = -1; ky <= 1; ky++) {
+                for (int kx = -1; kx <= 1; kx++) {
+                    const float gaussian = (ky == 0 ? 0.5f : 0.25f) * (kx == 0 ? 0.5f : 0.25f);
+                    local_variance = local_variance + vfloat::broadcast(gaussian) * vfloat::load(&variance[in][p + ptrdiff_t(ky) * stride + kx]);
+                }
+            }
+            const vfloat luminance_scale = vfloat::broadcast(1.0f) / (sigma_luminance * sqrt(max(local_variance, vfloat::broadcast(0.0f))) + epsilon);
+            const vfloat depth_scale = vfloat::broadcast(1.0f) / (sigma_depth * vfloat::load(&depth_gradient[p]) + epsilon);
+
+            vfloat sum_weight = vfloat::broadcast(1e-10f);
+            vfloat sum_r = vfloat::broadcast(0.0f), sum_g = sum_r, sum_b = sum_r, sum_variance = sum_r;
+
+            for (int ky = -2; ky <= 2; ky++) {
+                for (int kx = -2; kx <= 2; kx++) {
+                    const size_t q = p + ptrdiff_t(ky) * step * stride + kx * step;
+                    const vfloat qr = vfloat::load(&red[in][q]), qg = vfloat::load(&green[in][q]), qb = vfloat::load(&blue[in][q]);
+                    const vfloat ql = qr * luma_r + qg * luma_g + qb * luma_b;
+
+                    const vfloat dnx = vfloat::load(&normal_x[q]) - nx, dny = vfloat::load(&normal_y[q]) - ny, dnz = vfloat::load(&normal_z[q]) - nz;
+                    // Depth may change by the gradient per pixel of offset
+                    const vfloat depth_term = abs(vfloat::load(&depth[q]) - z) * depth_scale * vfloat::broadcast(1.0f / std::max(std::abs(kx) + std::abs(ky), 1));
+
+                    const vfloat exponent = abs(ql - l) * luminance_scale + (dnx * dnx + dny * dny + dnz * dnz) * normal_weight + depth_term;
+                    const vfloat weight = vfloat::load(&valid[q]) * vfloat::broadcast(kernel[ky + 2] * kernel[kx + 2]) * fast_exp(vfloat::broadcast(0.0f) - exponent);
+
+                    sum_weight = sum_weight + weight;
+                    sum_r = sum_r + weight * qr;
+                    sum_g = sum_g + weight * qg;
+                    sum_b = sum_b + weight * qb;
+                    sum_variance = sum_variance + weight * weight * vfloat::load(&variance[in][q]);
+                }
+            }
+
+            const vfloat inverse = vfloat::broadcast(1.0f) / sum_weight;
+            (sum_r * inverse).store(&red[out][p]);
+            (sum_g * inverse).store(&green[out][p]);
+            (sum_b * inverse).store(&blue[out][p]);
+            (sum_variance * inverse * inverse).store(&variance[out][p]);
+        }
+    }
+};
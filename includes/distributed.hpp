@@ -0,0 +1,325 @@
+#pragma once
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "scene_file.hpp"
+#include "socket.hpp"
+#include "tracer.hpp"
+
+// Splits one frame over worker processes. The coordinator listens, every worker that connects
+// receives the render settings and the scene as a binary scene file once, then takes work items,
+// a tile and a range of sample indices each, and returns the sum of those samples per pixel.
+// Sample indices are global, so the merged sums hold exactly the samples a local render takes and
+// the mean only differs by rounding.
+//
+// Items are handed out on demand with two in flight per worker, which keeps fast workers busy and
+// hides the round trip. Items of a worker that disconnects or stops answering go back into the queue.
+namespace farm {
+
+constexpr char magic[8] = "PTFARM";
+constexpr uint32_t version = 1;
+constexpr uint32_t endian_tag = 0x01020304;
+constexpr uint32_t stop_item = ~0u;
+constexpr size_t items_in_flight = 2;
+// Larger scenes in a job header are taken for corruption
+constexpr uint64_t max_scene_size = uint64_t(16) << 30;
+
+struct JobHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    int32_t width;
+    int32_t height;
+    int32_t max_depth;
+    int32_t roulette_depth;
+    uint8_t next_event;
+    uint8_t russian_roulette;
+    uint8_t sampler;
+    uint8_t integrator;
+    uint32_t seed;
+    uint64_t scene_size;
+};
+
+struct WorkItem {
+    uint32_t id;
+    int32_t x0, y0, x1, y1;
+    uint32_t first_sample;
+    uint32_t sample_count;
+};
+
+// Followed by the (x1 - x0) * (y1 - y0) per pixel sums of the item
+struct WorkResult {
+    uint32_t id;
+    PathCounters counters;
+};
+
+}  // namespace farm
+
+struct Coordinator {
+    farm::JobHeader job{};
+    std::vector<char> scene;
+    // Work item size, smaller tiles balance better, fewer samples per item let more workers share a tile
+    int item_size = 64;
+    int item_samples = 0;
+    // Seconds a send or a wait for a result may take before the worker counts as hung and its
+    // items go to others
+    int worker_timeout = 300;
+
+    std::vector<farm::WorkItem> items;
+    std::deque<uint32_t> queue;
+    size_t finished = 0;
+    std::vector<Color> sums;
+    std::vector<uint32_t> counts;
+    PathCounters total;
+    int workers_seen = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // Packs the tracer's settings and scene into the job every worker receives
+    bool Prepare(const Tracer& tracer, std::string& error) {
+        char path[] = "/tmp/raytracer_farm_XXXXXX";
+        const int fd = mkstemp(path);
+        if (fd < 0) {
+            error = "cannot create a temporary scene file";
+            return false;
+        }
+        close(fd);
+
+        const bool written = WriteSceneBinary(path, tracer.world, tracer.camera, error);
+        MappedFile file{path};
+        unlink(path);
+        if (!written || !file.valid()) {
+            error = written ? "cannot read back the temporary scene file" : error;
+            return false;
+        }
+        scene.assign(file.data, file.data + file.size);
+
+        std::memcpy(job.magic, farm::magic, sizeof(farm::magic));
+        job.version = farm::version;
+        job.endian = farm::endian_tag;
+        job.width = tracer.texture_size.x;
+        job.height = tracer.texture_size.y;
+        job.max_depth = tracer.settings.max_depth;
+        job.roulette_depth = tracer.settings.roulette_depth;
+        job.next_event = tracer.settings.next_event;
+        job.russian_roulette = tracer.settings.russian_roulette;
+        job.sampler = uint8_t(tracer.sampler_type);
+        job.integrator = uint8_t(tracer.integrator);
+        job.seed = tracer.seed;
+        job.scene_size = scene.size();
+        return true;
+    }
+
+    // Renders spp samples of every pixel on whichever workers connect to listener, then stores the
+    // merged mean in the tracer's accumulation buffer
+    void Render(Socket& listener, Tracer& tracer, int spp) {
+        const int chunk = item_samples > 0 ? std::min(item_samples, spp) : spp;
+        for (int y = 0; y < job.height; y += item_size) {
+            for (int x = 0; x < job.width; x += item_size) {
+                for (int sample = 0; sample < spp; sample += chunk) {
+                    const uint32_t id = items.size();
+                    items.push_back(farm::WorkItem{id, x, y, std::min(x + item_size, job.width), std::min(y + item_size, job.height), uint32_t(sample),
+                                                   uint32_t(std::min(chunk, spp - sample))});
+                    queue.push_back(id);
+                }
+            }
+        }
+        sums.assign(size_t(job.width) * job.height, Color{0.0f});
+        counts.assign(sums.size(), 0);
+
+        std::vector<std::thread> connections;
+        while (true) {
+            {
+                std::lock_guard lock{mutex};
+                if (finished == items.size()) {
+                    break;
+                }
+            }
+
+            if (Socket worker = listener.Accept(100); worker.valid()) {
+                connections.emplace_back([this, socket = std::move(worker)]() mutable { Serve(socket); });
+            }
+        }
+        for (std::thread& connection : connections) {
+            connection.join();
+        }
+
+        for (size_t i = 0; i < sums.size(); i++) {
+            tracer.pixels[i] = sums[i] / float(std::max(counts[i], 1u));
+        }
+        tracer.samples = spp;
+        tracer.total = total;
+    }
+
+  private:
+    // Feeds one worker until every item is done or the worker goes away
+    void Serve(Socket& socket) {
+        std::deque<uint32_t> in_flight;
+        std::vector<Color> result;
+
+        auto fail = [&] {
+            std::lock_guard lock{mutex};
+            queue.insert(queue.end(), in_flight.begin(), in_flight.end());
+            changed.notify_all();
+        };
+
+        // A peer that stops reading would block the send, and the join in Render, forever
+        socket.SetTimeout(worker_timeout);
+        if (!socket.Send(job) || !socket.SendAll(scene.data(), scene.size())) {
+            fail();
+            return;
+        }
+        {
+            std::lock_guard lock{mutex};
+            workers_seen++;
+        }
+
+        while (true) {
+            {
+                std::unique_lock lock{mutex};
+                if (in_flight.empty()) {
+                    changed.wait(lock, [&] { return !queue.empty() || finished == items.size(); });
+                }
+                while (in_flight.size() < farm::items_in_flight && !queue.empty()) {
+                    const uint32_t id = queue.front();
+                    queue.pop_front();
+                    in_flight.push_back(id);
+                    lock.unlock();
+                    const bool sent = socket.Send(items[id]);
+                    lock.lock();
+                    if (!sent) {
+                        lock.unlock();
+                        fail();
+                        return;
+                    }
+                }
+                if (in_flight.empty()) {
+                    lock.unlock();
+                    farm::WorkItem stop{farm::stop_item, 0, 0, 0, 0, 0, 0};
+                    socket.Send(stop);
+                    return;
+                }
+            }
+
+            farm::WorkResult header;
+            if (!socket.Receive(header) || header.id != in_flight.front()) {
+                fail();
+                return;
+            }
+            const farm::WorkItem& item = items[header.id];
+            const int width = item.x1 - item.x0;
+            result.resize(size_t(width) * (item.y1 - item.y0));
+            if (!socket.ReceiveAll(result.data(), result.size() * sizeof(Color))) {
+                fail();
+                return;
+            }
+            in_flight.pop_front();
+
+            std::lock_guard lock{mutex};
+            for (int y = item.y0; y < item.y1; y++) {
+                for (int x = item.x0; x < item.x1; x++) {
+                    const size_t i = size_t(y) * job.width + x;
+                    sums[i] += result[size_t(y - item.y0) * width + x - item.x0];
+                    counts[i] += item.sample_count;
+                }
+            }
+            total += header.counters;
+            finished++;
+            changed.notify_all();
+        }
+    }
+};
+
+// Connects to a coordinator, renders the items it hands out and returns when it says stop
+inline bool RunWorker(const std::string& address, unsigned threads, std::string& error) {
+    Socket socket;
+    // The coordinator may still be starting up
+    for (int attempt = 0; attempt < 50 && !socket.valid(); attempt++) {
+        socket = Socket::Connect(address, error);
+        if (!socket.valid()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    if (!socket.valid()) {
+        return false;
+    }
+
+    farm::JobHeader job;
+    if (!socket.Receive(job) || std::memcmp(job.magic, farm::magic, sizeof(farm::magic)) != 0 || job.version != farm::version ||
+        job.endian != farm::endian_tag || job.width <= 0 || job.height <= 0 || job.max_depth < 0 || job.roulette_depth < 0 ||
+        job.sampler > uint8_t(SamplerType::Sobol) || job.integrator > uint8_t(Integrator::Wavefront) || job.scene_size > farm::max_scene_size) {
+        error = address + " did not send a compatible job";
+        return false;
+    }
+
+    // The loader maps the scene, the mapping outlives the unlinked file
+    char path[] = "/tmp/raytracer_farm_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        error = "cannot create a temporary scene file";
+        return false;
+    }
+    // Copied through a fixed buffer, the scene never has to fit in memory twice
+    std::vector<char> chunk(1 << 20);
+    bool received = true, written = true;
+    for (uint64_t left = job.scene_size; left > 0 && received && written;) {
+        const size_t size = std::min<uint64_t>(left, chunk.size());
+        received = socket.ReceiveAll(chunk.data(), size);
+        written = received && write(fd, chunk.data(), size) == ssize_t(size);
+        left -= size;
+    }
+    close(fd);
+
+    Tracer tracer{float(job.width) / job.height, threads};
+    const bool loaded = written && LoadSceneBinary(path, tracer.world, tracer.camera, error);
+    unlink(path);
+    if (!loaded) {
+        error = received ? (written ? error : "cannot write the temporary scene file") : "connection lost while receiving the scene";
+        return false;
+    }
+
+    tracer.settings.max_depth = job.max_depth;
+    tracer.settings.roulette_depth = job.roulette_depth;
+    tracer.settings.next_event = job.next_event;
+    tracer.settings.russian_roulette = job.russian_roulette;
+    tracer.sampler_type = SamplerType(job.sampler);
+    tracer.integrator = Integrator(job.integrator);
+    tracer.seed = job.seed;
+    tracer.Resize(job.width, job.height);
+    tracer.camera.UpdateVectors();
+
+    std::vector<Color> sums;
+    while (true) {
+        farm::WorkItem item;
+        if (!socket.Receive(item)) {
+            error = "connection to " + address + " lost";
+            return false;
+        }
+        if (item.id == farm::stop_item) {
+            return true;
+        }
+        if (item.x0 < 0 || item.y0 < 0 || item.x1 > job.width || item.y1 > job.height || item.x0 >= item.x1 || item.y0 >= item.y1) {
+            error = address + " sent a malformed work item";
+            return false;
+        }
+
+        tracer.RenderRegion({item.x0, item.y0}, {item.x1, item.y1}, item.first_sample, item.sample_count, sums);
+
+        const farm::WorkResult result{item.id, tracer.FrameCounters()};
+        if (!socket.Send(result) || !socket.SendAll(sums.data(), sums.size() * sizeof(Color))) {
+            error = "connection to " + address + " lost";
+            return false;
+        }
+    }
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "image_io.hpp"
+#include "utils.hpp"
+
+// Discrete distribution sampled in constant time with Walker's alias method: every entry keeps
+// the probability of returning itself and the entry it hands the rest of its slot to.
+struct AliasTable {
+    std::vector<float> probability;
+    std::vector<uint32_t> alias;
+    // Normalized weights, what Sample returns each entry with
+    std::vector<float> pmf;
+
+    bool empty() const {
+        return pmf.empty();
+    }
+
+    // Leaves the table empty when no weight is positive
+    void Build(const std::vector<float>& weights) {
+        probability.clear();
+        alias.clear();
+        pmf.clear();
+
+        double total = 0.0;
+        for (float weight : weights) {
+            total += std::max(weight, 0.0f);
+        }
+        if (!(total > 0.0)) {
+            return;
+        }
+
+        const size_t n = weights.size();
+        probability.resize(n);
+        alias.resize(n);
+        pmf.resize(n);
+
+        // Vose's variant, entries below the average slot are topped up from ones above it
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; i++) {
+            pmf[i] = float(std::max(weights[i], 0.0f) / total);
+            scaled[i] = std::max(weights[i], 0.0f) / total * n;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            const uint32_t less = small.back();
+            const uint32_t more = large.back();
+            small.pop_back();
+
+            probability[less] = float(scaled[less]);
+            alias[less] = more;
+            scaled[more] -= 1.0 - scaled[less];
+            if (scaled[more] < 1.0) {
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+
+        // Whatever is left holds a full slot up to rounding
+        for (uint32_t i : large) {
+            probability[i] = 1.0f;
+            alias[i] = i;
+        }
+        for (uint32_t i : small) {
+            probability[i] = 1.0f;
+            alias[i] = i;
+        }
+    }
+
+    // u_index picks the slot, u_coin decides between it and its alias
+    uint32_t Sample(float u_index, float u_coin) const {
+        const uint32_t slot = std::min(uint32_t(double(u_index) * probability.size()), uint32_t(probability.size() - 1));
+        return u_coin < probability[slot] ? slot : alias[slot];
+    }
+};
+
+// Light at infinite distance from an equirectangular (latitude-longitude) image, .hdr or .pfm.
+// Rows run from straight down at the bottom to straight up (+y) at the top, the middle column
+// looks along -z and rotation turns the image around +y. Pixels are sampled proportionally to
+// their luminance times the solid angle they cover, so the sun and bright sky get the shadow rays.
+struct Environment {
+    int width = 0;
+    int height = 0;
+    std::vector<Color> pixels;
+    float intensity = 1.0f;
+    // Radians
+    float rotation = 0.0f;
+    AliasTable distribution;
+
+    bool empty() const {
+        return pixels.empty();
+    }
+
+    bool Load(const std::string& path, std::string& error) {
+        const std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+        int image_width, image_height;
+        std::vector<Color> image;
+        bool ok;
+
+        if (extension == ".hdr" || extension == ".HDR") {
+            ok = ReadHDR(path, image_width, image_height, image);
+        } else if (extension == ".pfm" || extension == ".PFM") {
+            ok = ReadPFM(path, image_width, image_height, image);
+        } else {
+            error = "unknown environment format " + extension + ", expected .hdr or .pfm";
+            return false;
+        }
+
+        if (!ok) {
+            error = "cannot read " + path;
+            return false;
+        }
+
+        Set(image_width, image_height, std::move(image));
+        return true;
+    }
+
+    // Takes the image bottom row first and builds the sampling distribution
+    void Set(int image_width, int image_height, std::vector<Color> image) {
+        width = image_width;
+        height = image_height;
+        pixels = std::move(image);
+
+        std::vector<float> weights(pixels.size());
+        for (int y = 0; y < height; y++) {
+            const float sin_theta = std::sin(float(pi) * (y + 0.5f) / height);
+            for (int x = 0; x < width; x++) {
+                const size_t i = size_t(y) * width + x;
+                weights[i] = std::max(luminance(pixels[i]), 0.0f) * sin_theta;
+            }
+        }
+        distribution.Build(weights);
+    }
+
+    Color Eval(const vec3& direction) const {
+        float sin_theta;
+        return pixels[PixelIndex(normalize(direction), sin_theta)] * intensity;
+    }
+
+    // Solid angle density of Sample
+    float Pdf(const vec3& direction) const {
+        if (distribution.empty()) {
+            return 0.0f;
+        }
+        float sin_theta;
+        const size_t i = PixelIndex(normalize(direction), sin_theta);
+        return sin_theta > 0.0f ? distribution.pmf[i] * PixelDensity() / sin_theta : 0.0f;
+    }
+
+    // Picks a pixel with u_select and a direction within it with u_point, pdf is per solid angle
+    bool Sample(const vec2& u_select, const vec2& u_point, vec3& direction, Color& radiance, float& pdf) const {
+        if (distribution.empty()) {
+            return false;
+        }
+
+        const uint32_t i = distribution.Sample(u_select.x, u_select.y);
+        const float u = (i % width + u_point.x) / width;
+        const float v = (i / width + u_point.y) / height;
+
+        const float theta = float(pi) * (1.0f - v);
+        const float phi = 2.0f * float(pi) * (u - 0.5f) + rotation;
+        const float sin_theta = std::sin(theta);
+        if (sin_theta <= 0.0f) {
+            return false;
+        }
+
+        direction = vec3{sin_theta * std::sin(phi), std::cos(theta), -sin_theta * std::cos(phi)};
+        radiance = pixels[i] * intensity;
+        pdf = distribution.pmf[i] * PixelDensity() / sin_theta;
+        return pdf > 0.0f;
+    }
+
+  private:
+    // Pixel probability to solid angle density, without the 1 / sin(theta) of the mapping
+    float PixelDensity() const {
+        return float(width) * height / (2.0f * float(pi) * float(pi));
+    }
+
+    size_t PixelIndex(const vec3& direction, float& sin_theta) const {
+        const float cos_theta = clamp(direction.y, -1.0f, 1.0f);
+        sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+
+        float u = (std::atan2(direction.x, -direction.z) - rotation) / (2.0f * float(pi)) + 0.5f;
+        u -= std::floor(u);
+        const float v = 1.0f - std::acos(cos_theta) / float(pi);
+
+        const int x = std::min(int(u * width), width - 1);
+        const int y = std::min(int(v * height), height - 1);
+        return size_t(y) * width + x;
+    }
+};
@@ -6,6 +6,10 @@
 struct hit_record {
     vec3 point;
     vec3 normal;
+    // Filled in by the scene, the shape and material as (type, index in the array of that type)
+    int shape_type;
+    int shape_index;
+    int mat_type;
     int mat_index;
     float t;
     bool front_face;
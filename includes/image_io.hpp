@@ -0,0 +1,323 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+
+// Images are stored bottom row first, the same way the accumulation buffer and GL textures are.
+
+// Readers take larger sizes in a header for corruption instead of trying to allocate them
+constexpr int max_image_dimension = 1 << 16;
+constexpr size_t max_image_pixels = size_t(1) << 28;
+
+// Bytes from the current position to the end of the file
+inline bool RemainingBytes(FILE* file, uint64_t& bytes) {
+    const off_t position = ftello(file);
+    if (position < 0 || fseeko(file, 0, SEEK_END) != 0) {
+        return false;
+    }
+    const off_t end = ftello(file);
+    bytes = end >= position ? uint64_t(end - position) : 0;
+    return end >= 0 && fseeko(file, position, SEEK_SET) == 0;
+}
+
+// Little endian PFM, keeps the linear floating point radiance
+inline bool WritePFM(const std::string& path, int width, int height, const std::vector<Color>& pixels) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+    bool ok = std::fwrite(pixels.data(), sizeof(Color), pixels.size(), file) == pixels.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// Reads PFM files written by WritePFM, grayscale and big endian files are converted
+inline bool ReadPFM(const std::string& path, int& width, int& height, std::vector<Color>& pixels) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char type[3] = {};
+    float scale;
+    if (std::fscanf(file, "%2s %d %d %f", type, &width, &height, &scale) != 4 || type[0] != 'P' || (type[1] != 'F' && type[1] != 'f') ||
+        width <= 0 || height <= 0 || width > max_image_dimension || height > max_image_dimension) {
+        std::fclose(file);
+        return false;
+    }
+    std::fgetc(file);
+
+    // A header promising more pixels than the file holds is not allocated for
+    const int channels = type[1] == 'F' ? 3 : 1;
+    uint64_t remaining;
+    if (!RemainingBytes(file, remaining) || remaining < uint64_t(width) * height * channels * sizeof(float)) {
+        std::fclose(file);
+        return false;
+    }
+
+    std::vector<float> data(size_t(width) * height * channels);
+    bool ok = std::fread(data.data(), sizeof(float), data.size(), file) == data.size();
+    std::fclose(file);
+
+    if (scale > 0.0f) {
+        for (float& value : data) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = __builtin_bswap32(bits);
+            std::memcpy(&value, &bits, sizeof(bits));
+        }
+    }
+
+    pixels.resize(size_t(width) * height);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = channels == 3 ? Color{data[i * 3], data[i * 3 + 1], data[i * 3 + 2]} : Color{data[i]};
+    }
+
+    return ok;
+}
+
+inline float RMSE(const std::vector<Color>& a, const std::vector<Color>& b) {
+    double sum = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        vec3 d = a[i] - b[i];
+        sum += dot(d, d) / 3.0f;
+    }
+    return std::sqrt(sum / a.size());
+}
+
+// Binary 8-bit PPM, expects already tonemapped values in [0, 1]
+inline bool WritePPM(const std::string& path, int width, int height, const std::vector<Color>& pixels) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+
+    std::vector<unsigned char> row(width * 3);
+    bool ok = true;
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            const Color& c = pixels[y * width + x];
+            row[x * 3 + 0] = (unsigned char)(clamp(c.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+            row[x * 3 + 1] = (unsigned char)(clamp(c.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+            row[x * 3 + 2] = (unsigned char)(clamp(c.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+        ok = ok && std::fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+
+    return std::fclose(file) == 0 && ok;
+}
+
+// Radiance RGBE pixel, three 8-bit mantissas sharing one exponent. A third of the size of float
+// RGB, every channel is within 0.4% of the pixel's brightest one.
+struct Rgbe {
+    uint8_t r, g, b, e;
+};
+
+// Negative and non finite channels are stored as 0
+inline Rgbe ToRgbe(const Color& color) {
+    auto finite = [](float value) { return std::isfinite(value) && value > 0.0f ? value : 0.0f; };
+    const Color c{finite(color.r), finite(color.g), finite(color.b)};
+
+    const float largest = std::max(std::max(c.r, c.g), c.b);
+    if (!(largest > 1e-32f)) {
+        return Rgbe{0, 0, 0, 0};
+    }
+    int exponent;
+    const float scale = std::frexp(largest, &exponent) * 256.0f / largest;
+    // frexp puts the mantissa below 1, the clamp only guards against rounding up to 256
+    auto mantissa = [&](float value) { return uint8_t(std::min(value * scale, 255.0f)); };
+    return Rgbe{mantissa(c.r), mantissa(c.g), mantissa(c.b), uint8_t(exponent + 128)};
+}
+
+inline Color FromRgbe(const Rgbe& rgbe) {
+    if (rgbe.e == 0) {
+        return Color{0.0f};
+    }
+    const float scale = std::ldexp(1.0f, int(rgbe.e) - (128 + 8));
+    return Color{(rgbe.r + 0.5f) * scale, (rgbe.g + 0.5f) * scale, (rgbe.b + 0.5f) * scale};
+}
+
+// Reads Radiance .hdr files in the usual -Y +X orientation, flat or with run length encoded
+// scanlines (each channel of a row as its own runs), which is what most tools write
+inline bool ReadHDR(const std::string& path, int& width, int& height, std::vector<Color>& pixels) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    // Header lines up to an empty one, then the resolution line
+    char line[256];
+    bool rgbe = true;
+    bool first = true;
+    while (std::fgets(line, sizeof(line), file) && line[0] != '\n') {
+        if (first && std::strncmp(line, "#?", 2) != 0) {
+            std::fclose(file);
+            return false;
+        }
+        if (std::strncmp(line, "FORMAT=", 7) == 0) {
+            rgbe = std::strncmp(line + 7, "32-bit_rle_rgbe", 15) == 0;
+        }
+        first = false;
+    }
+
+    if (first || !rgbe || std::fscanf(file, "-Y %d +X %d", &height, &width) != 2 || width <= 0 || height <= 0 || width > max_image_dimension ||
+        height > max_image_dimension || size_t(width) * height > max_image_pixels) {
+        std::fclose(file);
+        return false;
+    }
+    std::fgetc(file);
+
+    // Run length encoding lets a small file claim a large image, so pixels only grow as rows decode
+    pixels.clear();
+    std::vector<uint8_t> row(size_t(width) * 4);
+    bool ok = true;
+
+    for (int y = 0; y < height && ok; y++) {
+        uint8_t start[4];
+        ok = std::fread(start, 1, 4, file) == 4;
+        const bool encoded = ok && width >= 8 && width < 32768 && start[0] == 2 && start[1] == 2 && ((start[2] << 8) | start[3]) == width;
+
+        if (ok && encoded) {
+            // Channel planes, a count above 128 repeats the next byte count - 128 times
+            for (int channel = 0; channel < 4 && ok; channel++) {
+                for (int x = 0; x < width && ok;) {
+                    const int count = std::fgetc(file);
+                    if (count > 128) {
+                        const int value = std::fgetc(file);
+                        ok = value != EOF && x + count - 128 <= width;
+                        for (int i = 0; ok && i < count - 128; i++) {
+                            row[size_t(x++) * 4 + channel] = uint8_t(value);
+                        }
+                    } else {
+                        ok = count > 0 && x + count <= width;
+                        for (int i = 0; ok && i < count; i++) {
+                            const int value = std::fgetc(file);
+                            ok = value != EOF;
+                            row[size_t(x++) * 4 + channel] = uint8_t(value);
+                        }
+                    }
+                }
+            }
+        } else if (ok) {
+            std::memcpy(row.data(), start, 4);
+            ok = std::fread(row.data() + 4, 1, row.size() - 4, file) == row.size() - 4;
+        }
+
+        for (int x = 0; ok && x < width; x++) {
+            pixels.push_back(FromRgbe(Rgbe{row[x * 4], row[x * 4 + 1], row[x * 4 + 2], row[x * 4 + 3]}));
+        }
+    }
+    std::fclose(file);
+
+    if (!ok) {
+        return false;
+    }
+
+    // The file starts with the top row
+    for (int y = 0; y < height / 2; y++) {
+        std::swap_ranges(pixels.begin() + size_t(y) * width, pixels.begin() + size_t(y + 1) * width, pixels.begin() + size_t(height - 1 - y) * width);
+    }
+    return true;
+}
+
+// An image file that receives its rows as they finish, in any order, so the image never has to be
+// in memory as a whole. Every format has fixed size rows, a row goes straight to its offset.
+// Rows count from the bottom like the accumulation buffer.
+struct StreamedImage {
+    enum class Format {
+        // 8-bit, expects tonemapped values in [0, 1]
+        PPM,
+        // Uncompressed Radiance RGBE
+        HDR,
+        PFM,
+    };
+
+    Format format = Format::PPM;
+    int width = 0;
+    int height = 0;
+
+    StreamedImage() = default;
+    StreamedImage(const StreamedImage&) = delete;
+    StreamedImage& operator=(const StreamedImage&) = delete;
+
+    ~StreamedImage() {
+        Close();
+    }
+
+    bool Open(const std::string& path, Format image_format, int image_width, int image_height) {
+        Close();
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        format = image_format;
+        width = image_width;
+        height = image_height;
+
+        if (format == Format::PPM) {
+            std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+        } else if (format == Format::HDR) {
+            std::fprintf(file, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %d +X %d\n", height, width);
+        } else {
+            std::fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+        }
+        data_offset = ftello(file);
+        return data_offset > 0;
+    }
+
+    // Writes count rows starting at row y from pixels, which holds them row major, bottom row first
+    bool WriteRows(int y, int count, const std::vector<Color>& pixels) {
+        const size_t pixel_size = format == Format::PPM ? 3 : format == Format::HDR ? 4 : sizeof(Color);
+        row.resize(size_t(width) * pixel_size);
+
+        for (int i = 0; i < count; i++) {
+            const Color* source = &pixels[size_t(i) * width];
+            for (int x = 0; x < width; x++) {
+                unsigned char* out = &row[size_t(x) * pixel_size];
+                if (format == Format::PPM) {
+                    out[0] = (unsigned char)(clamp(source[x].r, 0.0f, 1.0f) * 255.0f + 0.5f);
+                    out[1] = (unsigned char)(clamp(source[x].g, 0.0f, 1.0f) * 255.0f + 0.5f);
+                    out[2] = (unsigned char)(clamp(source[x].b, 0.0f, 1.0f) * 255.0f + 0.5f);
+                } else if (format == Format::HDR) {
+                    const Rgbe rgbe = ToRgbe(source[x]);
+                    std::memcpy(out, &rgbe, sizeof(rgbe));
+                } else {
+                    std::memcpy(out, &source[x], sizeof(Color));
+                }
+            }
+
+            // PFM stores the bottom row first, the others the top row
+            const int file_row = format == Format::PFM ? y + i : height - 1 - (y + i);
+            if (fseeko(file, data_offset + off_t(file_row) * off_t(row.size()), SEEK_SET) != 0 || std::fwrite(row.data(), 1, row.size(), file) != row.size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Close() {
+        if (!file) {
+            return true;
+        }
+        const bool ok = std::fclose(file) == 0;
+        file = nullptr;
+        return ok;
+    }
+
+  private:
+    FILE* file = nullptr;
+    off_t data_offset = 0;
+    std::vector<unsigned char> row;
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "hit_record.hpp"
+#include "ray.hpp"
+#include "sampler.hpp"
+
+struct PathSettings {
+    int max_depth = 8;
+    bool next_event = true;
+    bool russian_roulette = true;
+    int roulette_depth = 3;
+    // Intersect camera rays in packets, only changes the speed
+    bool packets = true;
+};
+
+// Per worker statistics, merged once per frame. Rays deeper than the last depth bucket are
+// counted in it, material_hits is indexed by the material's position in the scene's type list.
+struct alignas(64) PathCounters {
+    static constexpr int depth_buckets = 16;
+    static constexpr int max_material_types = 8;
+
+    uint64_t rays = 0;
+    uint64_t shadow_rays = 0;
+    uint64_t roulette_kills = 0;
+    uint64_t intersection_tests = 0;
+    uint64_t busy_ns = 0;
+    std::array<uint64_t, depth_buckets> depth_rays{};
+    std::array<uint64_t, max_material_types> material_hits{};
+
+    void CountRay(int depth) {
+        rays++;
+        depth_rays[std::min(depth, depth_buckets - 1)]++;
+    }
+
+    PathCounters& operator+=(const PathCounters& other) {
+        rays += other.rays;
+        shadow_rays += other.shadow_rays;
+        roulette_kills += other.roulette_kills;
+        intersection_tests += other.intersection_tests;
+        busy_ns += other.busy_ns;
+        for (int i = 0; i < depth_buckets; i++) {
+            depth_rays[i] += other.depth_rays[i];
+        }
+        for (int i = 0; i < max_material_types; i++) {
+            material_hits[i] += other.material_hits[i];
+        }
+        return *this;
+    }
+};
+
+// Attributes of a camera ray's first hit, they guide the denoiser and reprojection. A ray that
+// escapes the scene keeps the defaults.
+struct PathFeatures {
+    Color albedo{0.0f};
+    vec3 normal{0.0f};
+    // In units of the camera ray direction
+    float distance = infinity;
+};
+
+struct PathState {
+    Ray ray;
+    Color throughput{1.0f};
+    Color radiance{0.0f};
+    float bsdf_pdf = 0.0f;
+    bool specular = true;
+    PathFeatures features;
+};
+
+// Surface color the denoiser divides out of the lighting, materials without one pass light unchanged
+template <typename Mat>
+Color FeatureAlbedo(const Mat& mat) {
+    if constexpr (requires { mat.albedo; }) {
+        return clamp(mat.albedo, 0.0f, 1.0f);
+    } else {
+        return Color{1.0f};
+    }
+}
+
+// Light sample waiting for its visibility test, adds contribution to the path when unoccluded
+struct ShadowRay {
+    Ray ray;
+    float t_max;
+    Color contribution;
+};
+
+// Balance heuristic squared (power heuristic with beta = 2)
+inline float power_heuristic(float pdf, float other_pdf) {
+    float a = pdf * pdf;
+    float b = other_pdf * other_pdf;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+// Adds the environment seen by a path that escaped the scene, MIS weighted against light
+// sampling the same way emission is
+template <typename World>
+void ShadeMiss(const World& world, const PathSettings& settings, PathState& path) {
+    if (world.environment.empty()) {
+        return;
+    }
+
+    float weight = 1.0f;
+    if (settings.next_event && !path.specular) {
+        weight = power_heuristic(path.bsdf_pdf, world.EnvironmentPdf(path.ray.direction));
+    }
+    path.radiance += path.throughput * world.environment.Eval(path.ray.direction) * weight;
+}
+
+// Shades one path vertex: adds emission (MIS weighted against light sampling), prepares a
+// next-event shadow ray for non specular materials, then samples the material to extend the
+// path and applies Russian roulette. Returns false when the path terminates here.
+template <typename World, typename Mat>
+bool ShadeHit(const World& world, const Mat& mat, const hit_record& rec, int depth, const PathSettings& settings, PathState& path,
+              Sampler& sampler, ShadowRay& shadow, bool& has_shadow, PathCounters& counters) {
+    has_shadow = false;
+
+    if (depth == 0) {
+        path.features = PathFeatures{FeatureAlbedo(mat), rec.normal, rec.t};
+    }
+
+    Color emitted = mat.emitted();
+    if (emitted != Color{0.0f}) {
+        float weight = 1.0f;
+        if (settings.next_event && !path.specular) {
+            weight = power_heuristic(path.bsdf_pdf, world.LightPdf(rec, path.ray.origin));
+        }
+        path.radiance += path.throughput * emitted * weight;
+    }
+
+    constexpr bool has_bsdf = requires(const Mat& m) { m.eval(rec, vec3{}); };
+
+    if constexpr (has_bsdf) {
+        if (settings.next_event) {
+            typename World::LightSample light;
+            vec2 u_select = sampler.Get2D();
+            vec2 u_point = sampler.Get2D();
+
+            if (world.SampleLight(rec.point, u_select, u_point, light)) {
+                Color f = mat.eval(rec, light.direction);
+                if (f != Color{0.0f}) {
+                    float weight = power_heuristic(light.pdf, mat.pdf(rec, light.direction));
+                    shadow.ray = Ray(rec.point, light.direction);
+                    shadow.t_max = light.distance * (1.0f - 1e-4f);
+                    shadow.contribution = path.throughput * f * light.emitted * (weight / light.pdf);
+                    has_shadow = true;
+                    counters.shadow_rays++;
+                }
+            }
+        }
+    }
+
+    Color attenuation;
+    Ray scattered;
+    if (!mat.scatter(path.ray, rec, attenuation, scattered, sampler)) {
+        return false;
+    }
+
+    path.throughput *= attenuation;
+    path.ray = scattered;
+
+    if constexpr (has_bsdf) {
+        path.bsdf_pdf = mat.pdf(rec, scattered.direction);
+        path.specular = false;
+    } else {
+        path.specular = true;
+    }
+
+    if (settings.russian_roulette && depth >= settings.roulette_depth) {
+        float survive = std::min(std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z)), 0.95f);
+        if (sampler.Get1D() >= survive) {
+            counters.roulette_kills++;
+            return false;
+        }
+        path.throughput /= survive;
+    }
+
+    return true;
+}
@@ -4,6 +4,8 @@
 
 #include "hit_record.hpp"
 #include "ray.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
 #include "utils.hpp"
 
 struct Metal {
@@ -14,10 +16,10 @@ struct Metal {
     Metal(const Color& a) : albedo(a) {}
 
     Color emitted() const {
-        return albedo;
+        return Color{0};
     }
 
-    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered) const {
+    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered, Sampler& /*sampler*/) const {
         vec3 reflected = reflect(normalize(ray.direction), rec.normal);
         scattered = Ray(rec.point, reflected);
         attenuation = albedo;
@@ -33,11 +35,11 @@ struct Lambertian {
     Lambertian(const Color& a) : albedo(a) {}
 
     Color emitted() const {
-        return albedo;
+        return Color{0};
     }
 
-    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered) const {
-        vec3 scatter_direction = rec.normal + normalize(random_in_unit_sphere(GRSEED));
+    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const {
+        vec3 scatter_direction = cosine_hemisphere(rec.normal, sampler.Get2D());
 
         if (near_zero(scatter_direction)) {
             scatter_direction = rec.normal;
@@ -47,6 +49,17 @@ struct Lambertian {
         attenuation = albedo;
         return true;
     }
+
+    // BSDF times cosine for a given outgoing direction, used by next-event estimation.
+    // Materials without eval/pdf are treated as specular and never sample lights.
+    Color eval(const hit_record& rec, const vec3& direction) const {
+        return albedo * std::max(dot(rec.normal, normalize(direction)), 0.0f) * float(1.0 / pi);
+    }
+
+    // Solid angle density scatter() picks direction with
+    float pdf(const hit_record& rec, const vec3& direction) const {
+        return std::max(dot(rec.normal, normalize(direction)), 0.0f) * float(1.0 / pi);
+    }
 };
 
 struct DiffuseLight {
@@ -60,7 +73,7 @@ struct DiffuseLight {
         return albedo;
     }
 
-    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered) const {
+    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered, Sampler& /*sampler*/) const {
         return false;
     }
 };
@@ -76,18 +89,18 @@ struct Dielectric {
         return Color{0};
     }
 
-    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered) const {
+    bool scatter(const Ray& ray, const hit_record& rec, Color& attenuation, Ray& scattered, Sampler& sampler) const {
         attenuation = Color{1.0, 1.0, 1.0};
-        float refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        float refraction_ratio = rec.front_face ? (1.0f / ir) : ir;
 
         vec3 unit_direction = normalize(ray.direction);
-        float cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        float sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+        float cos_theta = std::min(dot(-unit_direction, rec.normal), 1.0f);
+        float sin_theta = std::sqrt(std::max(1.0f - cos_theta * cos_theta, 0.0f));
 
-        bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+        bool cannot_refract = refraction_ratio * sin_theta > 1.0f;
         vec3 direction;
 
-        if (cannot_refract || refractance(cos_theta, refraction_ratio) > random_float(GRSEED))
+        if (cannot_refract || refractance(cos_theta, refraction_ratio) > sampler.Get1D())
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
@@ -100,6 +113,6 @@ struct Dielectric {
     float refractance(float cosine, float ref_idx) const {
         float r0 = (1.0f - ref_idx) / (1.0f + ref_idx);
         r0 = r0 * r0;
-        return r0 + (1 - r0) * pow((1.0f - cosine), 5);
+        return sampling::schlick(cosine, r0);
     }
 };
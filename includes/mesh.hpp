@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "aabb.hpp"
+#include "buffer.hpp"
+#include "bvh.hpp"
+#include "hit_record.hpp"
+
+// Shared vertex and index buffers of a triangle mesh plus its own BVH over the triangles.
+// Several TriangleMesh instances can reference the same data.
+struct MeshData {
+    Buffer<vec3> positions;
+    Buffer<uint32_t> indices;
+    BVH bvh;
+
+    size_t triangle_count() const {
+        return indices.size() / 3;
+    }
+
+    // Builds the triangle BVH and reorders the index buffer into leaf order,
+    // so the triangles of a leaf are contiguous in memory
+    void Build() {
+        std::vector<AABB> bounds(triangle_count());
+        for (size_t i = 0; i < bounds.size(); i++) {
+            bounds[i].grow(positions[indices[i * 3 + 0]]);
+            bounds[i].grow(positions[indices[i * 3 + 1]]);
+            bounds[i].grow(positions[indices[i * 3 + 2]]);
+        }
+        bvh.Build(bounds);
+
+        std::vector<uint32_t> ordered(indices.size());
+        for (size_t i = 0; i < bvh.indices.size(); i++) {
+            const uint32_t tri = bvh.indices[i];
+            ordered[i * 3 + 0] = indices[tri * 3 + 0];
+            ordered[i * 3 + 1] = indices[tri * 3 + 1];
+            ordered[i * 3 + 2] = indices[tri * 3 + 2];
+            bvh.indices[i] = i;
+        }
+        indices = std::move(ordered);
+    }
+};
+
+// Per ray constants of the watertight ray/triangle test from Woop, Benthin and Wald,
+// "Watertight Ray/Triangle Intersection" (JCGT 2013)
+struct WatertightRay {
+    int kx, ky, kz;
+    float sx, sy, sz;
+
+    WatertightRay(const vec3& direction) {
+        vec3 d = glm::abs(direction);
+        kz = d.x > d.y ? (d.x > d.z ? 0 : 2) : (d.y > d.z ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        if (direction[kz] < 0.0f) {
+            std::swap(kx, ky);
+        }
+
+        sx = direction[kx] / direction[kz];
+        sy = direction[ky] / direction[kz];
+        sz = 1.0f / direction[kz];
+    }
+
+    // Distance along the ray, no edge between two triangles lets a ray slip through
+    bool Intersect(const vec3& origin, const vec3& v0, const vec3& v1, const vec3& v2, float& t) const {
+        const vec3 a = v0 - origin;
+        const vec3 b = v1 - origin;
+        const vec3 c = v2 - origin;
+
+        const float ax = a[kx] - sx * a[kz];
+        const float ay = a[ky] - sy * a[kz];
+        const float bx = b[kx] - sx * b[kz];
+        const float by = b[ky] - sy * b[kz];
+        const float cx = c[kx] - sx * c[kz];
+        const float cy = c[ky] - sy * c[kz];
+
+        float u = cx * by - cy * bx;
+        float v = ax * cy - ay * cx;
+        float w = bx * ay - by * ax;
+
+        // Fall back to double precision right on an edge
+        if (u == 0.0f || v == 0.0f || w == 0.0f) {
+            u = float(double(cx) * double(by) - double(cy) * double(bx));
+            v = float(double(ax) * double(cy) - double(ay) * double(cx));
+            w = float(double(bx) * double(ay) - double(by) * double(ax));
+        }
+
+        if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+            return false;
+        }
+
+        const float det = u + v + w;
+        if (det == 0.0f) {
+            return false;
+        }
+
+        const float az = sz * a[kz];
+        const float bz = sz * b[kz];
+        const float cz = sz * c[kz];
+        t = (u * az + v * bz + w * cz) / det;
+        return true;
+    }
+};
+
+struct TriangleMesh {
+    std::shared_ptr<const MeshData> data;
+    vec3 center{0.0f};
+
+    TriangleMesh() = default;
+
+    TriangleMesh(std::shared_ptr<const MeshData> _data, const vec3& offset = vec3{0.0f}) : data{std::move(_data)}, center{offset} {}
+
+    bool Hit(const Ray& ray, float t_min, float t_max, hit_record& rec) const {
+        // center translates the whole mesh, move the ray into mesh space instead
+        const Ray local(ray.origin - center, ray.direction);
+        const WatertightRay watertight(ray.direction);
+        const vec3* positions = data->positions.data();
+        const uint32_t* indices = data->indices.data();
+
+        float closest = t_max;
+        uint32_t hit_tri = 0;
+
+        bool hit = data->bvh.Traverse(local, t_min, closest, [&](uint32_t tri, float& closest_so_far) {
+            float t;
+            const uint32_t* idx = indices + tri * 3;
+            if (watertight.Intersect(local.origin, positions[idx[0]], positions[idx[1]], positions[idx[2]], t) && t >= t_min && t < closest_so_far) {
+                closest_so_far = t;
+                hit_tri = tri;
+                return true;
+            }
+            return false;
+        });
+
+        if (!hit) {
+            return false;
+        }
+
+        const uint32_t* idx = indices + hit_tri * 3;
+        const vec3& v0 = positions[idx[0]];
+        vec3 outward_normal = normalize(cross(positions[idx[1]] - v0, positions[idx[2]] - v0));
+
+        rec.t = closest;
+        rec.point = ray.at(rec.t);
+        rec.set_face_normal(ray, outward_normal);
+        return true;
+    }
+
+    AABB Bounds() const {
+        const AABB& local = data->bvh.nodes.empty() ? AABB{} : data->bvh.nodes[0].bounds;
+        return local.empty() ? local : AABB{local.min + center, local.max + center};
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+
+namespace mesh_loader {
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* skip_line(const char* p, const char* end) {
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline ? newline + 1 : end;
+}
+
+// Decimal number parser without locale or allocation, precise enough for geometry
+inline const char* parse_float(const char* p, const char* end, float& out) {
+    static constexpr double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    const char* start = p;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (digits++ < 18) {
+            mantissa = mantissa * 10 + (*p - '0');
+        } else {
+            exponent++;
+        }
+    }
+
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits++ < 18) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+
+    if (p == start) {
+        return nullptr;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negative_exponent = *q++ == '-';
+        }
+        int value = 0;
+        const char* exponent_start = q;
+        for (; q < end && *q >= '0' && *q <= '9'; q++) {
+            value = std::min(value * 10 + (*q - '0'), 1000);
+        }
+        if (q != exponent_start) {
+            exponent += negative_exponent ? -value : value;
+            p = q;
+        }
+    }
+
+    double value = double(mantissa);
+    if (exponent < 0) {
+        value = exponent >= -22 ? value / powers[-exponent] : value * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        value = exponent <= 22 ? value * powers[exponent] : value * std::pow(10.0, exponent);
+    }
+
+    out = float(negative ? -value : value);
+    return p;
+}
+
+inline const char* parse_int(const char* p, const char* end, int64_t& out) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    const char* start = p;
+    int64_t value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (*p - '0');
+    }
+
+    if (p == start) {
+        return nullptr;
+    }
+
+    out = negative ? -value : value;
+    return p;
+}
+
+// Positions and faces only, polygons are fan triangulated, normals and texture coordinates are skipped
+inline bool ParseOBJ(const char* data, size_t size, MeshData& mesh, std::string& error) {
+    const char* p = data;
+    const char* end = data + size;
+    size_t line = 0;
+
+    while (p < end) {
+        line++;
+        p = skip_spaces(p, end);
+
+        if (end - p > 1 && p[0] == 'v' && is_space(p[1])) {
+            vec3 v;
+            p += 2;
+            for (int i = 0; i < 3; i++) {
+                p = p ? parse_float(skip_spaces(p, end), end, v[i]) : nullptr;
+            }
+            if (!p) {
+                error = "bad vertex on line " + std::to_string(line);
+                return false;
+            }
+            mesh.positions.push_back(v);
+        } else if (end - p > 1 && p[0] == 'f' && is_space(p[1])) {
+            uint32_t first = 0, previous = 0;
+            int corners = 0;
+            p += 2;
+
+            while (true) {
+                p = skip_spaces(p, end);
+                if (p >= end || *p == '\n' || *p == '#') {
+                    break;
+                }
+
+                int64_t index;
+                p = parse_int(p, end, index);
+                if (!p) {
+                    error = "bad face on line " + std::to_string(line);
+                    return false;
+                }
+
+                // Negative indices count back from the last vertex
+                index = index < 0 ? int64_t(mesh.positions.size()) + index : index - 1;
+                if (index < 0 || index >= int64_t(mesh.positions.size())) {
+                    error = "face index out of range on line " + std::to_string(line);
+                    return false;
+                }
+
+                // Skip the texture coordinate and normal references
+                while (p < end && !is_space(*p) && *p != '\n') {
+                    p++;
+                }
+
+                if (corners == 0) {
+                    first = index;
+                } else if (corners >= 2) {
+                    mesh.indices.push_back(first);
+                    mesh.indices.push_back(previous);
+                    mesh.indices.push_back(index);
+                }
+                previous = index;
+                corners++;
+            }
+        }
+
+        p = skip_line(p, end);
+    }
+
+    return true;
+}
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+inline PlyType ply_type(const char* name, size_t length) {
+    const std::string_view type{name, length};
+    if (type == "char" || type == "int8") return PlyType::Int8;
+    if (type == "uchar" || type == "uint8") return PlyType::UInt8;
+    if (type == "short" || type == "int16") return PlyType::Int16;
+    if (type == "ushort" || type == "uint16") return PlyType::UInt16;
+    if (type == "int" || type == "int32") return PlyType::Int32;
+    if (type == "uint" || type == "uint32") return PlyType::UInt32;
+    if (type == "float" || type == "float32") return PlyType::Float32;
+    if (type == "double" || type == "float64") return PlyType::Float64;
+    return PlyType::Invalid;
+}
+
+inline size_t ply_size(PlyType type) {
+    switch (type) {
+        case PlyType::Int8:
+        case PlyType::UInt8: return 1;
+        case PlyType::Int16:
+        case PlyType::UInt16: return 2;
+        case PlyType::Int32:
+        case PlyType::UInt32:
+        case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+        default: return 0;
+    }
+}
+
+template <typename T>
+T ply_load(const char* p, bool swap) {
+    T value;
+    if (swap) {
+        char bytes[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); i++) {
+            bytes[i] = p[sizeof(T) - 1 - i];
+        }
+        std::memcpy(&value, bytes, sizeof(T));
+    } else {
+        std::memcpy(&value, p, sizeof(T));
+    }
+    return value;
+}
+
+inline double ply_read(const char* p, PlyType type, bool swap) {
+    switch (type) {
+        case PlyType::Int8: return ply_load<int8_t>(p, swap);
+        case PlyType::UInt8: return ply_load<uint8_t>(p, swap);
+        case PlyType::Int16: return ply_load<int16_t>(p, swap);
+        case PlyType::UInt16: return ply_load<uint16_t>(p, swap);
+        case PlyType::Int32: return ply_load<int32_t>(p, swap);
+        case PlyType::UInt32: return ply_load<uint32_t>(p, swap);
+        case PlyType::Float32: return ply_load<float>(p, swap);
+        case PlyType::Float64: return ply_load<double>(p, swap);
+        default: return 0.0;
+    }
+}
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    PlyType count_type = PlyType::Invalid;
+    bool is_list = false;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+};
+
+// Binary little and big endian PLY, reads vertex x/y/z and face vertex_indices
+inline bool ParsePLY(const char* data, size_t size, MeshData& mesh, std::string& error) {
+    const char* p = data;
+    const char* end = data + size;
+
+    if (size < 4 || std::memcmp(p, "ply", 3) != 0) {
+        error = "missing ply magic";
+        return false;
+    }
+
+    bool swap = false;
+    std::vector<PlyElement> elements;
+
+    // The header is tiny, so it is fine to allocate while reading it
+    while (true) {
+        p = skip_line(p, end);
+        if (p >= end) {
+            error = "missing end_header";
+            return false;
+        }
+
+        const char* line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        line_end = line_end ? line_end : end;
+
+        std::vector<std::string_view> words;
+        for (const char* q = p; q < line_end;) {
+            q = skip_spaces(q, line_end);
+            const char* word = q;
+            while (q < line_end && !is_space(*q)) {
+                q++;
+            }
+            if (q > word) {
+                words.emplace_back(word, q - word);
+            }
+        }
+
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+            continue;
+        }
+
+        if (words[0] == "end_header") {
+            p = line_end + 1;
+            break;
+        }
+
+        if (words[0] == "format" && words.size() >= 2) {
+            if (words[1] == "binary_little_endian") {
+                swap = std::endian::native != std::endian::little;
+            } else if (words[1] == "binary_big_endian") {
+                swap = std::endian::native != std::endian::big;
+            } else {
+                error = "only binary PLY files are supported";
+                return false;
+            }
+        } else if (words[0] == "element" && words.size() == 3) {
+            elements.push_back(PlyElement{std::string(words[1]), std::strtoull(std::string(words[2]).c_str(), nullptr, 10), {}});
+        } else if (words[0] == "property" && !elements.empty()) {
+            PlyProperty property;
+            if (words.size() == 5 && words[1] == "list") {
+                property.is_list = true;
+                property.count_type = ply_type(words[2].data(), words[2].size());
+                property.type = ply_type(words[3].data(), words[3].size());
+                property.name = words[4];
+            } else if (words.size() == 3) {
+                property.type = ply_type(words[1].data(), words[1].size());
+                property.name = words[2];
+            } else {
+                error = "bad property declaration";
+                return false;
+            }
+
+            if (property.type == PlyType::Invalid || (property.is_list && property.count_type == PlyType::Invalid)) {
+                error = "unknown property type";
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+
+    for (const PlyElement& element : elements) {
+        const bool is_vertex = element.name == "vertex";
+        const bool is_face = element.name == "face";
+
+        size_t stride = 0;
+        bool fixed_size = true;
+        int xyz_offset[3] = {-1, -1, -1};
+        PlyType xyz_type[3];
+
+        for (const PlyProperty& property : element.properties) {
+            if (property.is_list) {
+                fixed_size = false;
+                continue;
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                if (property.name.size() == 1 && property.name[0] == "xyz"[axis]) {
+                    xyz_offset[axis] = stride;
+                    xyz_type[axis] = property.type;
+                }
+            }
+            stride += ply_size(property.type);
+        }
+
+        if (is_vertex) {
+            if (!fixed_size || xyz_offset[0] < 0 || xyz_offset[1] < 0 || xyz_offset[2] < 0) {
+                error = "vertex element needs fixed size x, y and z properties";
+                return false;
+            }
+            if (element.count > SIZE_MAX / stride || size_t(end - p) < element.count * stride) {
+                error = "truncated vertex data";
+                return false;
+            }
+
+            mesh.positions.resize(element.count);
+            for (size_t i = 0; i < element.count; i++, p += stride) {
+                for (int axis = 0; axis < 3; axis++) {
+                    mesh.positions[i][axis] = xyz_type[axis] == PlyType::Float32 && !swap
+                                                  ? ply_load<float>(p + xyz_offset[axis], false)
+                                                  : float(ply_read(p + xyz_offset[axis], xyz_type[axis], swap));
+                }
+            }
+        } else if (fixed_size) {
+            if ((stride > 0 && element.count > SIZE_MAX / stride) || size_t(end - p) < element.count * stride) {
+                error = "truncated " + element.name + " data";
+                return false;
+            }
+            p += element.count * stride;
+        } else {
+            // Every element takes at least a byte, which bounds a corrupt count
+            mesh.indices.reserve(is_face ? std::min(element.count, size_t(end - p)) * 3 : 0);
+
+            for (size_t i = 0; i < element.count; i++) {
+                for (const PlyProperty& property : element.properties) {
+                    const size_t count_size = ply_size(property.count_type);
+                    const size_t item_size = ply_size(property.type);
+
+                    if (!property.is_list) {
+                        if (size_t(end - p) < item_size) {
+                            error = "truncated " + element.name + " data";
+                            return false;
+                        }
+                        p += item_size;
+                        continue;
+                    }
+
+                    if (size_t(end - p) < count_size) {
+                        error = "truncated " + element.name + " data";
+                        return false;
+                    }
+                    const size_t count = size_t(ply_read(p, property.count_type, swap));
+                    p += count_size;
+
+                    if (count > size_t(end - p) / item_size) {
+                        error = "truncated " + element.name + " data";
+                        return false;
+                    }
+
+                    if (is_face && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+                        uint32_t first = 0, previous = 0;
+                        for (size_t corner = 0; corner < count; corner++) {
+                            const uint32_t index = uint32_t(ply_read(p + corner * item_size, property.type, swap));
+                            if (index >= mesh.positions.size()) {
+                                error = "face index out of range";
+                                return false;
+                            }
+                            if (corner == 0) {
+                                first = index;
+                            } else if (corner >= 2) {
+                                mesh.indices.push_back(first);
+                                mesh.indices.push_back(previous);
+                                mesh.indices.push_back(index);
+                            }
+                            previous = index;
+                        }
+                    }
+
+                    p += count * item_size;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+}  // namespace mesh_loader
+
+// Loads an .obj or binary .ply file and builds its BVH, returns nullptr and sets error on failure
+inline std::shared_ptr<MeshData> LoadMesh(const std::string& path, std::string& error) {
+    MappedFile file{path};
+    if (!file.valid()) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+
+    auto mesh = std::make_shared<MeshData>();
+    const std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    bool ok;
+
+    if (extension == ".obj" || extension == ".OBJ") {
+        ok = mesh_loader::ParseOBJ(file.data, file.size, *mesh, error);
+    } else if (extension == ".ply" || extension == ".PLY") {
+        ok = mesh_loader::ParsePLY(file.data, file.size, *mesh, error);
+    } else {
+        error = "unknown mesh format " + extension;
+        return nullptr;
+    }
+
+    if (!ok) {
+        error = path + ": " + error;
+        return nullptr;
+    }
+
+    if (mesh->indices.empty()) {
+        error = path + ": no triangles";
+        return nullptr;
+    }
+
+    mesh->Build();
+    return mesh;
+}
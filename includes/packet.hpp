@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "aabb.hpp"
+#include "ray.hpp"
+#include "simd.hpp"
+
+// Up to 64 rays that travel through the BVH together, meant for coherent rays such as the camera
+// rays of an 8x8 pixel block. Each node is tested for simd_width rays at a time, and the bounding
+// intervals of the packet's origins and inverse directions reject nodes that every ray misses with
+// a single test (interval culling, as in Wald et al. 2006 and Reshetov's MLRTA).
+//
+// Rays are kept as Ray for the primitive kernels and as structure of arrays for the node tests.
+// Lanes past size are padding whose closest distance is -infinity, so they never hit anything.
+struct RayPacket {
+    static constexpr int side = 8;
+    static constexpr int max_size = side * side;
+    static constexpr uint32_t no_hit = ~0u;
+
+    int size = 0;
+    Ray rays[max_size];
+    alignas(32) float origin_x[max_size];
+    alignas(32) float origin_y[max_size];
+    alignas(32) float origin_z[max_size];
+    alignas(32) float inv_x[max_size];
+    alignas(32) float inv_y[max_size];
+    alignas(32) float inv_z[max_size];
+    alignas(32) float closest[max_size];
+    uint32_t hit_slot[max_size];
+
+    // Filled in by Finish. The intervals are only usable when no direction component is zero or
+    // changes sign within the packet, a shared origin lets the node tests subtract it once per node.
+    bool shared_origin = false;
+    bool interval = false;
+    vec3 origin_min, origin_max, inv_min, inv_max;
+
+    void Clear() {
+        size = 0;
+    }
+
+    void Add(const Ray& ray, float t_max) {
+        const int i = size++;
+        rays[i] = ray;
+        origin_x[i] = ray.origin.x;
+        origin_y[i] = ray.origin.y;
+        origin_z[i] = ray.origin.z;
+        inv_x[i] = ray.inv_direction.x;
+        inv_y[i] = ray.inv_direction.y;
+        inv_z[i] = ray.inv_direction.z;
+        closest[i] = t_max;
+        hit_slot[i] = no_hit;
+    }
+
+    int groups() const {
+        return (size + simd_width - 1) / simd_width;
+    }
+
+    // Pads the last group and computes the culling intervals, call once all rays are added
+    void Finish() {
+        for (int i = size; i < groups() * simd_width; i++) {
+            origin_x[i] = origin_y[i] = origin_z[i] = 0.0f;
+            inv_x[i] = inv_y[i] = inv_z[i] = 1.0f;
+            closest[i] = -std::numeric_limits<float>::infinity();
+        }
+
+        origin_min = origin_max = rays[0].origin;
+        inv_min = inv_max = rays[0].inv_direction;
+        for (int i = 1; i < size; i++) {
+            origin_min = min(origin_min, rays[i].origin);
+            origin_max = max(origin_max, rays[i].origin);
+            inv_min = min(inv_min, rays[i].inv_direction);
+            inv_max = max(inv_max, rays[i].inv_direction);
+        }
+
+        shared_origin = origin_min == origin_max;
+        interval = true;
+        for (int axis = 0; axis < 3; axis++) {
+            const bool finite = std::isfinite(inv_min[axis]) && std::isfinite(inv_max[axis]);
+            interval = interval && finite && (inv_min[axis] > 0.0f || inv_max[axis] < 0.0f);
+        }
+    }
+
+    float MaxClosest() const {
+        float result = -std::numeric_limits<float>::infinity();
+        for (int i = 0; i < size; i++) {
+            result = std::max(result, closest[i]);
+        }
+        return result;
+    }
+
+    // Lanes of group whose ray enters bounds before its closest hit so far, as a bit mask
+    unsigned GroupHit(int group, const AABB& bounds, float t_min) const {
+        const int i = group * simd_width;
+        vfloat min_x, min_y, min_z, max_x, max_y, max_z;
+        if (shared_origin) {
+            const vec3 near = bounds.min - rays[0].origin;
+            const vec3 far = bounds.max - rays[0].origin;
+            min_x = vfloat::broadcast(near.x), min_y = vfloat::broadcast(near.y), min_z = vfloat::broadcast(near.z);
+            max_x = vfloat::broadcast(far.x), max_y = vfloat::broadcast(far.y), max_z = vfloat::broadcast(far.z);
+        } else {
+            const vfloat ox = vfloat::load(&origin_x[i]), oy = vfloat::load(&origin_y[i]), oz = vfloat::load(&origin_z[i]);
+            min_x = vfloat::broadcast(bounds.min.x) - ox, min_y = vfloat::broadcast(bounds.min.y) - oy, min_z = vfloat::broadcast(bounds.min.z) - oz;
+            max_x = vfloat::broadcast(bounds.max.x) - ox, max_y = vfloat::broadcast(bounds.max.y) - oy, max_z = vfloat::broadcast(bounds.max.z) - oz;
+        }
+
+        const vfloat ix = vfloat::load(&inv_x[i]), iy = vfloat::load(&inv_y[i]), iz = vfloat::load(&inv_z[i]);
+        const vfloat t0x = min_x * ix, t1x = max_x * ix;
+        const vfloat t0y = min_y * iy, t1y = max_y * iy;
+        const vfloat t0z = min_z * iz, t1z = max_z * iz;
+
+        const vfloat enter = max(max(vfloat::broadcast(t_min), min(t0x, t1x)), max(min(t0y, t1y), min(t0z, t1z)));
+        const vfloat exit = min(min(vfloat::load(&closest[i]), max(t0x, t1x)), min(max(t0y, t1y), max(t0z, t1z)));
+        return less_equal_mask(enter, exit);
+    }
+
+    // True when the intervals prove that no ray reaches bounds within [t_min, max_closest]. Every
+    // slab distance (plane - origin) * inv lies between the extremes of the interval products.
+    bool Culled(const AABB& bounds, float t_min, float max_closest) const {
+        if (!interval) {
+            return false;
+        }
+
+        float enter = t_min;
+        float exit = max_closest;
+        for (int axis = 0; axis < 3; axis++) {
+            const bool positive = inv_min[axis] > 0.0f;
+            const float near_plane = positive ? bounds.min[axis] : bounds.max[axis];
+            const float far_plane = positive ? bounds.max[axis] : bounds.min[axis];
+
+            float low, high;
+            Product(near_plane - origin_max[axis], near_plane - origin_min[axis], inv_min[axis], inv_max[axis], low, high);
+            enter = std::max(enter, low);
+            Product(far_plane - origin_max[axis], far_plane - origin_min[axis], inv_min[axis], inv_max[axis], low, high);
+            exit = std::min(exit, high);
+        }
+        return enter > exit;
+    }
+
+  private:
+    static void Product(float a_low, float a_high, float b_low, float b_high, float& low, float& high) {
+        const float p0 = a_low * b_low, p1 = a_low * b_high, p2 = a_high * b_low, p3 = a_high * b_high;
+        low = std::min(std::min(p0, p1), std::min(p2, p3));
+        high = std::max(std::max(p0, p1), std::max(p2, p3));
+    }
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Timeline of a few frames for chrome://tracing or https://ui.perfetto.dev. Workers only ever
+// append to their own event list, so recording needs no synchronization beyond the frame barrier.
+struct Profiler {
+    struct Event {
+        const char* name;
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        int64_t value = -1;
+    };
+
+    // Lane 0 belongs to the thread driving the frame, worker i records into lane i + 1
+    std::vector<std::vector<Event>> lanes;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    int frames_to_record = 0;
+
+    bool recording() const {
+        return frames_to_record > 0;
+    }
+
+    uint64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void Start(int frames, unsigned workers) {
+        lanes.assign(workers + 1, {});
+        frames_to_record = frames;
+    }
+
+    // The pool can grow while recording
+    void Reserve(unsigned workers) {
+        if (lanes.size() < workers + 1) {
+            lanes.resize(workers + 1);
+        }
+    }
+
+    void Record(unsigned worker, const char* name, uint64_t start_ns, uint64_t end_ns, int64_t value = -1) {
+        if (recording()) {
+            lanes[worker + 1].push_back(Event{name, start_ns, end_ns - start_ns, value});
+        }
+    }
+
+    void RecordMain(const char* name, uint64_t start_ns, uint64_t end_ns, int64_t value = -1) {
+        if (recording() && !lanes.empty()) {
+            lanes[0].push_back(Event{name, start_ns, end_ns - start_ns, value});
+        }
+    }
+
+    // Counts a finished frame, returns true once the requested number has been recorded
+    bool EndFrame() {
+        return recording() && --frames_to_record == 0;
+    }
+
+    bool WriteChromeTrace(const std::string& path) const {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            return false;
+        }
+
+        std::fprintf(file, "{\"traceEvents\": [\n");
+        for (size_t lane = 0; lane < lanes.size(); lane++) {
+            const std::string name = lane == 0 ? "main" : "worker " + std::to_string(lane - 1);
+            std::fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %zu, \"args\": {\"name\": \"%s\"}}",
+                         lane == 0 ? "" : ",\n", lane, name.c_str());
+
+            for (const Event& event : lanes[lane]) {
+                std::fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f", event.name, lane,
+                             event.start_ns * 1e-3, event.duration_ns * 1e-3);
+                if (event.value >= 0) {
+                    std::fprintf(file, ", \"args\": {\"value\": %lld}", (long long)event.value);
+                }
+                std::fprintf(file, "}");
+            }
+        }
+        std::fprintf(file, "\n]}\n");
+
+        return std::fclose(file) == 0;
+    }
+};
@@ -5,10 +5,11 @@
 struct Ray {
     vec3 origin;
     vec3 direction;
+    vec3 inv_direction;
 
     Ray() = default;
 
-    Ray(const vec3& _origin, const vec3& _direction) : origin{_origin}, direction{_direction} {}
+    Ray(const vec3& _origin, const vec3& _direction) : origin{_origin}, direction{_direction}, inv_direction{1.0f / _direction} {}
 
     vec3 at(float t) const {
         return origin + t * direction;
@@ -7,35 +7,92 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include <atomic>
+#include <cfloat>
+#include <condition_variable>
+#include <cstring>
 #include <glm/glm.hpp>
+#include <mutex>
 #include <thread>
+#include <type_traits>
+
+#include "scene_file.hpp"
+#include "scenes.hpp"
+#include "tracer.hpp"
+#include "triple_buffer.hpp"
+
+// Everything the settings window changes about a render. The window edits its own copy, the render
+// thread applies the latest one between frames, so neither side touches the other's state mid frame.
+struct RenderControls {
+    Camera camera{1.0f};
+    ivec2 texture_size{0, 0};
+    int workers = 1;
+    int tile_size = 16;
+    SamplerType sampler_type = SamplerType::Sobol;
+    Integrator integrator = Integrator::Recursive;
+    PathSettings settings;
+    AdaptiveSettings adaptive;
+    InteractiveSettings interactive;
+    DenoiseSettings denoise;
+};
 
-#include "camera.hpp"
-#include "scene.hpp"
-#include "shapes.hpp"
+// A finished frame together with the statistics the window shows for it
+struct PresentedFrame {
+    ivec2 size{0, 0};
+    std::vector<Rgba8> pixels;
+    int samples = 0;
+    bool moving = false;
+    int preview_scale = 1;
+    float converged = 0.0f;
+    bool done = false;
+    uint64_t frame_ns = 0;
+    PathCounters counters;
+    std::vector<uint64_t> busy_ns;
+    int trace_frames_left = 0;
+    std::string trace_status;
+};
 
 struct Renderer {
     GLFWwindow* window;
     GLuint texture;
     GLuint framebuffer;
-    Camera camera;
+    // Uploads alternate between two pixel buffers so a new frame never waits on the previous transfer
+    GLuint pixel_buffers[2];
+    int pixel_buffer = 0;
+    ivec2 texture_allocated{0, 0};
     ivec2 window_size;
-    ivec2 texture_size;
-    float last_render = 0.0f;
     float texture_size_multiplier = 1.0f;
-    int max_depth = 8;
-    int samples = 0;
     int entity_id = 0;
 
-    std::vector<Color> pixels;
-    // Maybe not the best practice to multiply this by 4 but seems like its working
-    std::vector<std::thread> threads{std::thread::hardware_concurrency() * 4};
-
-    using Objects = std::tuple<Sphere, Box>;
-    using Materials = std::tuple<Metal, Lambertian, DiffuseLight, Dielectric>;
-    Scene<Objects, Materials> world;
-
-    Renderer(int width, float aspect_ratio) : camera{aspect_ratio} {
+    Tracer tracer;
+    std::vector<std::string> mesh_paths;
+    std::string scene_path;
+    std::string environment_path;
+
+    // The window's copy of the controls and the latest one handed to the render thread
+    RenderControls controls;
+    RenderControls pending;
+    bool has_pending = false;
+    int requested_trace_frames = 0;
+    std::mutex control_mutex;
+    std::condition_variable control_changed;
+
+    std::thread render_thread;
+    std::atomic<bool> running = false;
+    TripleBuffer<PresentedFrame> frames;
+
+    // Milliseconds spent in each phase of the last window frame, trace time is the render thread's
+    struct FrameTimes {
+        float upload = 0.0f;
+        float ui = 0.0f;
+        float frame = 0.0f;
+    } frame_times;
+
+    int trace_frames = 30;
+    std::string trace_path = "trace.json";
+
+    Renderer(int width, float aspect_ratio, unsigned workers = std::thread::hardware_concurrency())
+        : tracer{aspect_ratio, workers} {
         int height = width / aspect_ratio;
 
         // Setup GLFW
@@ -66,6 +123,17 @@ struct Renderer {
         glGenFramebuffers(1, &framebuffer);
         glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glGenBuffers(2, pixel_buffers);
+
+        controls.camera = tracer.camera;
+        controls.workers = tracer.pool.size();
+        controls.tile_size = tracer.tile_size;
+        controls.sampler_type = tracer.sampler_type;
+        controls.integrator = tracer.integrator;
+        controls.settings = tracer.settings;
+        controls.adaptive = tracer.adaptive;
+        controls.interactive = tracer.interactive;
+        controls.denoise = tracer.denoise;
 
         // Initial window size
         glfwGetWindowSize(window, &window_size.x, &window_size.y);
@@ -73,6 +141,9 @@ struct Renderer {
     }
 
     ~Renderer() {
+        StopRenderThread();
+        glDeleteBuffers(2, pixel_buffers);
+
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
@@ -81,13 +152,30 @@ struct Renderer {
         glfwTerminate();
     }
 
-    Color& Pixel(int x, int y) {
-        return pixels[y * texture_size.x + x];
-    }
+    // Streams a frame into the texture through a pixel buffer, glTexSubImage2D then copies from GPU
+    // memory and the texture is only reallocated when the size changes
+    void UploadFrame(const PresentedFrame& frame) {
+        if (frame.pixels.empty()) {
+            return;
+        }
 
-    void WritePixelsToTexture() {
         glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, texture_size.x, texture_size.y, 0, GL_RGB, GL_FLOAT, pixels.data());
+        if (frame.size != texture_allocated) {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, frame.size.x, frame.size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            texture_allocated = frame.size;
+        }
+
+        const GLsizeiptr bytes = frame.pixels.size() * sizeof(Rgba8);
+        pixel_buffer ^= 1;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffers[pixel_buffer]);
+        // Orphaning the storage lets the driver hand out fresh memory instead of syncing with a pending read
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        if (void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)) {
+            std::memcpy(mapped, frame.pixels.data(), bytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.size.x, frame.size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
     }
 
     void OnResize(int w, int h) {
@@ -96,90 +184,212 @@ struct Renderer {
     }
 
     void ResizeTexture(int w, int h) {
-        // Resize CPU-side pixel storage
-        // (OpenGL Resources are automatically resized on WritePixelsToTexture)
-        texture_size = {w, h};
-        pixels.resize(texture_size.x * texture_size.y);
-
-        samples = 0;
+        // The render thread resizes the tracer, the texture follows the first frame of the new size
+        controls.texture_size = {w, h};
     }
 
-    Color RayColor(const Ray& ray, int depth) {
-        hit_record rec;
-
-        if (depth <= 0) {
-            return Color{0.0f};
+    // Hands the window's controls to the render thread and wakes it if it was idle
+    void SubmitControls() {
+        {
+            std::lock_guard lock{control_mutex};
+            pending = controls;
+            has_pending = true;
         }
+        control_changed.notify_one();
+    }
 
-        if (!world.Hit(ray, 0.001, infinity, rec)) {
-            return Color{0.0f, 0.0f, 0.0f};
+    // Render thread side of SubmitControls, restarts the accumulation for changes that alter the image.
+    // Returns true when the current image only needs to be displayed again.
+    bool ApplyControls(const RenderControls& next) {
+        if (next.texture_size != tracer.texture_size) {
+            tracer.Resize(next.texture_size.x, next.texture_size.y);
+        }
+        if (next.workers != int(tracer.pool.size())) {
+            tracer.pool.Resize(next.workers);
+        }
+        if (next.sampler_type != tracer.sampler_type || next.settings.next_event != tracer.settings.next_event ||
+            next.settings.russian_roulette != tracer.settings.russian_roulette) {
+            tracer.samples = 0;
         }
+        // Features are only accumulated while denoising
+        if (next.denoise.enabled && !tracer.denoise.enabled) {
+            tracer.samples = 0;
+        }
+        const bool redisplay = next.denoise != tracer.denoise;
+
+        tracer.camera = next.camera;
+        tracer.camera.UpdateVectors();
+        tracer.tile_size = next.tile_size;
+        tracer.sampler_type = next.sampler_type;
+        tracer.integrator = next.integrator;
+        tracer.settings = next.settings;
+        tracer.adaptive = next.adaptive;
+        tracer.interactive = next.interactive;
+        tracer.denoise = next.denoise;
+        return redisplay;
+    }
+
+    // Nothing changes the image until the controls or the scene do
+    bool RenderIdle() {
+        return !tracer.HasWork() || tracer.samples >= 1e8;
+    }
+
+    void RenderLoop() {
+        Profiler& profiler = tracer.profiler;
+        std::string trace_status;
+
+        while (true) {
+            bool redisplay = false;
+            {
+                std::unique_lock lock{control_mutex};
+                control_changed.wait(lock, [&] { return has_pending || !running || !RenderIdle(); });
+                if (!running) {
+                    return;
+                }
+                if (has_pending) {
+                    redisplay = ApplyControls(pending);
+                    has_pending = false;
+                }
+                if (requested_trace_frames > 0) {
+                    profiler.Start(requested_trace_frames, tracer.pool.size());
+                    requested_trace_frames = 0;
+                    trace_status.clear();
+                }
+            }
+            if (!RenderIdle()) {
+                tracer.MakePixels();
+            } else if (!redisplay) {
+                continue;
+            }
 
-        Ray scattered;
-        Color attenuation;
-        Color emitted;
-        bool scatter;
+            if (tracer.denoise.enabled && !tracer.moving) {
+                tracer.Denoise();
+            }
 
-        std::visit(
-            [&](const auto& mat) {
-                emitted = mat.emitted();
-                scatter = mat.scatter(ray, rec, attenuation, scattered);
-            },
-            world.materials[rec.mat_index]);
+            const uint64_t publish_start = profiler.Now();
+            PresentedFrame& frame = frames.Back();
+            tracer.Tonemap(frame.pixels);
+            frame.size = tracer.texture_size;
+            frame.samples = tracer.samples;
+            frame.moving = tracer.moving;
+            frame.preview_scale = tracer.preview_scale;
+            frame.converged = tracer.ConvergedFraction();
+            frame.done = tracer.Converged();
+            frame.frame_ns = tracer.frame_ns;
+            frame.counters = tracer.FrameCounters();
+            frame.busy_ns.resize(tracer.counters.size());
+            for (size_t i = 0; i < tracer.counters.size(); i++) {
+                frame.busy_ns[i] = tracer.counters[i].busy_ns;
+            }
 
-        if (!scatter) {
-            return emitted;
+            profiler.RecordMain("tonemap", publish_start, profiler.Now());
+            if (profiler.EndFrame()) {
+                trace_status = profiler.WriteChromeTrace(trace_path) ? "Wrote " + trace_path : "Failed to write " + trace_path;
+            }
+            frame.trace_frames_left = profiler.frames_to_record;
+            frame.trace_status = trace_status;
+            frames.Publish();
         }
+    }
 
-        return (emitted + attenuation) * RayColor(scattered, depth - 1);
+    void StopRenderThread() {
+        if (!render_thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard lock{control_mutex};
+            running = false;
+        }
+        control_changed.notify_one();
+        render_thread.join();
     }
 
-    void MakePixels(float weight) {
-        const auto make = [&](const int start, const int end) {
-            for (int y = start; y < end; y++) {
-                for (int x = 0; x < texture_size.x; x++) {
-                    float u = (x + norm01(rng)) / texture_size.x;
-                    float v = (y + norm01(rng)) / texture_size.y;
-                    Color color = RayColor(camera.get_ray(u, v), max_depth);
-                    color = pow(color, Color(1.0f / 2.2f));
-                    Pixel(x, y) = Pixel(x, y) * (1.0f - weight) + weight * color;
-                }
-            }
-        };
+    void StatisticsPanel(const PresentedFrame& shown) {
+        if (!ImGui::CollapsingHeader("Statistics")) {
+            return;
+        }
+
+        const PathCounters& frame = shown.counters;
+        const uint64_t rays = frame.rays + frame.shadow_rays;
+        const double trace_seconds = std::max(shown.frame_ns * 1e-9, 1e-9);
 
-        const size_t render_rows = threads.size();
-        const size_t render_rows_size = texture_size.y / render_rows;
+        ImGui::Text("Trace %.2f ms, upload %.2f ms, UI %.2f ms", shown.frame_ns * 1e-6f, frame_times.upload, frame_times.ui);
+        ImGui::Text("Kernels: %s", cpu::isa_name(cpu::isa));
+        ImGui::Text("Rays: %llu (%.2f Mrays/s)", (unsigned long long)rays, rays / trace_seconds * 1e-6);
+        ImGui::Text("Shadow rays: %llu, roulette kills: %llu", (unsigned long long)frame.shadow_rays, (unsigned long long)frame.roulette_kills);
+        ImGui::Text("Intersection tests per ray: %.2f", double(frame.intersection_tests) / std::max<uint64_t>(rays, 1));
+
+        float depth_rays[PathCounters::depth_buckets];
+        const int depths = std::clamp(controls.settings.max_depth, 1, PathCounters::depth_buckets);
+        for (int i = 0; i < depths; i++) {
+            depth_rays[i] = float(frame.depth_rays[i]);
+        }
+        ImGui::PlotHistogram("Rays per depth", depth_rays, depths, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+        for (size_t i = 0; i < Tracer::World::material_type_count; i++) {
+            ImGui::Text("%s hits: %llu", Tracer::material_names[i], (unsigned long long)frame.material_hits[i]);
+        }
 
-        for (size_t i = 0; i < render_rows; i++) {
-            threads[i] = std::thread(make, i * render_rows_size, (i + 1) * render_rows_size);
+        // Idle time is whatever part of the frame a worker spent outside of tiles
+        for (size_t i = 0; i < shown.busy_ns.size(); i++) {
+            const float busy = shown.busy_ns[i] * 1e-6f;
+            const float idle = std::max(shown.frame_ns * 1e-6f - busy, 0.0f);
+            char label[64];
+            std::snprintf(label, sizeof(label), "worker %zu: busy %.2f ms, idle %.2f ms", i, busy, idle);
+            ImGui::ProgressBar(busy / std::max(busy + idle, 1e-6f), ImVec2(-1.0f, 0.0f), label);
         }
 
-        for (auto& thread : threads) {
-            thread.join();
+        ImGui::InputInt("Trace frames", &trace_frames);
+        trace_frames = std::max(trace_frames, 1);
+        if (shown.trace_frames_left > 0) {
+            ImGui::Text("Recording, %d frames left", shown.trace_frames_left);
+        } else {
+            if (ImGui::Button("Record trace")) {
+                std::lock_guard lock{control_mutex};
+                requested_trace_frames = trace_frames;
+            }
+            if (!shown.trace_status.empty()) {
+                ImGui::TextUnformatted(shown.trace_status.c_str());
+            }
         }
     }
 
     void Run() {
-        auto ground_material = Lambertian(Color{0.3, 0.2, 0.1});
-        auto white_light = DiffuseLight(Color{1.0, 0.91, 0.81} * vec3{10.0f});
-        auto metal = Metal(Color{0.8, 0.8, 0.8});
-        auto lambertian = Lambertian(Color{1.0, 0.8, 1.0});
-        auto dielectric = Dielectric(1.5);
+        Tracer::World& world = tracer.world;
+
+        std::string error;
+        if (scene_path.empty()) {
+            DefaultScene(world);
+        } else if (!LoadScene(scene_path, world, tracer.camera, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            DefaultScene(world);
+        }
+
+        if (!mesh_paths.empty()) {
+            AddMeshes(world, mesh_paths);
+        }
 
-        world.add(Sphere(vec3{0.0f, -100.5f, -1.0f}, 100.0f), ground_material);
-        world.add(Sphere(vec3{0.0f, 7.0f, -12.0f}, 8.0f), white_light);
+        if (!environment_path.empty() && !world.environment.Load(environment_path, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+        }
 
-        world.add(Box(vec3(0, -0.5, -1), vec3(1, 3.0, 0)), white_light);
-        world.add(Box(vec3(-2.5, -0.5, -3.5), vec3(-1.5, 0.5, -2.5)), white_light);
+        // Tracing runs on its own thread from here on, the window only draws what it publishes
+        Camera& camera = controls.camera;
+        camera = tracer.camera;
+        running = true;
+        SubmitControls();
+        render_thread = std::thread([this] { RenderLoop(); });
 
-        world.add(Sphere(vec3{0.5f, 0.0f, -2.0f}, 0.5f), metal);
-        world.add(Sphere(vec3{-1.0f, 0.0f, -2.0f}, 0.5f), dielectric);
-        world.add(Sphere(vec3{-1.0f, 0.0f, -0.5f}, 0.5f), lambertian);
+        auto ms = [](auto start, auto end) { return std::chrono::duration<float, std::milli>(end - start).count(); };
 
-        std::chrono::steady_clock::time_point current_ticks, delta_ticks;
-        float ms;
         while (!glfwWindowShouldClose(window)) {
-            current_ticks = std::chrono::steady_clock::now();
+            const auto frame_start = std::chrono::steady_clock::now();
+
+            if (frames.Acquire()) {
+                UploadFrame(frames.Front());
+            }
+            const PresentedFrame& shown = frames.Front();
+            const auto upload_end = std::chrono::steady_clock::now();
 
             ImGui_ImplOpenGL3_NewFrame();
             ImGui_ImplGlfw_NewFrame();
@@ -187,59 +397,108 @@ struct Renderer {
 
             ImGui::Begin("Settings");
 
-            ImGui::Text("Sample: %i", samples);
-            ImGui::Text("Texture Size: (%i, %i)", texture_size.x, texture_size.y);
+            ImGui::Text("Sample: %i", shown.samples);
+            ImGui::Text("Texture Size: (%i, %i)", shown.size.x, shown.size.y);
 
             if (ImGui::SliderFloat("Texture scale", &texture_size_multiplier, 0.02f, 1.f)) {
                 ResizeTexture(int(window_size.x * texture_size_multiplier), int(window_size.y * texture_size_multiplier));
-                samples = 0;
             }
 
-            ImGui::Text("Last render: %.3fms", ms);
+            ImGui::Text("Last render: %.3fms, window frame: %.3fms", shown.frame_ns * 1e-6f, frame_times.frame);
 
-            if (ImGui::DragFloat3("Look From", &camera.look_from.x, 0.1f, -10.0f, 10.0f)) {
-                samples = 0;
+            if (ImGui::InputInt("Workers", &controls.workers)) {
+                controls.workers = std::max(controls.workers, 1);
             }
 
-            if (ImGui::DragFloat3("Look at", &camera.look_at.x, 0.1f, -10.0f, 10.0f)) {
-                samples = 0;
+            ImGui::SliderInt("Tile size", &controls.tile_size, 4, 128);
+
+            const char* sampler_names[] = {"Random", "Sobol"};
+            ImGui::Combo("Sampler", (int*)&controls.sampler_type, sampler_names, 2);
+
+            const char* integrator_names[] = {"Recursive", "Wavefront"};
+            ImGui::Combo("Integrator", (int*)&controls.integrator, integrator_names, 2);
+
+            ImGui::Checkbox("Next event estimation", &controls.settings.next_event);
+
+            ImGui::Checkbox("Russian roulette", &controls.settings.russian_roulette);
+
+            ImGui::Checkbox("Packet camera rays", &controls.settings.packets);
+
+            ImGui::Checkbox("Adaptive sampling", &controls.adaptive.enabled);
+            if (controls.adaptive.enabled) {
+                ImGui::SliderFloat("Error threshold", &controls.adaptive.threshold, 0.001f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderInt("Min samples", &controls.adaptive.min_samples, 1, 256);
+                ImGui::Text("Converged: %.1f%%%s", shown.converged * 100.0f, shown.done ? ", done" : "");
             }
 
-            if (ImGui::SliderFloat("FOV", &camera.vfov, 0.0f, 180.0f - 0.1f)) {
-                samples = 0;
+            ImGui::Checkbox("Denoise", &controls.denoise.enabled);
+            if (controls.denoise.enabled) {
+                ImGui::SliderInt("Filter passes", &controls.denoise.iterations, 1, Denoiser::max_iterations);
+                ImGui::SliderFloat("Luminance sigma", &controls.denoise.sigma_luminance, 1.0f, 64.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
             }
 
-            ImGui::InputInt("Entity ID", &entity_id);
+            ImGui::DragFloat3("Look From", &camera.look_from.x, 0.1f, -10.0f, 10.0f);
 
-            std::visit(
-                [&](auto&& object) {
-                    if (ImGui::DragFloat3("Object Coords", &object.center.x, 0.1, -10.0f, 10.0f)) {
-                        samples = 0;
-                    }
-                },
-                world.shapes[entity_id]);
+            ImGui::DragFloat3("Look at", &camera.look_at.x, 0.1f, -10.0f, 10.0f);
 
-            ImGui::End();
+            ImGui::SliderFloat("FOV", &camera.vfov, 0.0f, 180.0f - 0.1f);
 
-            camera.UpdateVectors();
+            // Camera changes are picked up by the tracer, which previews and reprojects them
+            ImGui::Checkbox("Interactive camera", &controls.interactive.enabled);
+            if (shown.moving) {
+                ImGui::Text("Preview at 1/%d resolution", shown.preview_scale);
+            }
 
-            if (samples < 1e8) {
-                MakePixels(1.0f / ++samples);
+            // An empty scene has nothing to edit
+            if (world.ObjectCount() > 0) {
+                ImGui::InputInt("Entity ID", &entity_id);
+                entity_id = std::clamp(entity_id, 0, int(world.ObjectCount()) - 1);
+
+                // Edits go through the tracer's staging copy and only refit the BVH
+                typename Tracer::World::Shape shape = tracer.StagedShape(entity_id);
+                const bool dragged = std::visit(
+                    [&](auto& object) {
+                        // Boxes are stored by their corners, they move by however far the center was dragged
+                        if constexpr (std::is_same_v<std::decay_t<decltype(object)>, Box>) {
+                            vec3 center = object.Center();
+                            if (!ImGui::DragFloat3("Object Coords", &center.x, 0.1, -10.0f, 10.0f)) {
+                                return false;
+                            }
+                            object.Translate(center - object.Center());
+                            return true;
+                        } else {
+                            return ImGui::DragFloat3("Object Coords", &object.center.x, 0.1, -10.0f, 10.0f);
+                        }
+                    },
+                    shape);
+                if (dragged) {
+                    tracer.EditObject(entity_id, shape);
+                }
             }
 
-            WritePixelsToTexture();
+            StatisticsPanel(shown);
+
+            ImGui::End();
+            SubmitControls();
+
             glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-            glBlitFramebuffer(0, 0, texture_size.x, texture_size.y, 0, 0, window_size.x, window_size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBlitFramebuffer(0, 0, texture_allocated.x, texture_allocated.y, 0, 0, window_size.x, window_size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
             ImGui::Render();
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-            glfwSwapBuffers(window);
+            const auto draw_end = std::chrono::steady_clock::now();
 
+            glfwSwapBuffers(window);
             glfwPollEvents();
-            delta_ticks = std::chrono::steady_clock::now();
-            ms = std::chrono::duration_cast<std::chrono::milliseconds>(delta_ticks - current_ticks).count();
+            const auto frame_end = std::chrono::steady_clock::now();
+
+            frame_times.upload = ms(frame_start, upload_end);
+            frame_times.ui = ms(upload_end, draw_end);
+            frame_times.frame = ms(frame_start, frame_end);
         }
+
+        StopRenderThread();
     }
 };
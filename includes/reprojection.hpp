@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cmath>
+#include <optional>
+#include <vector>
+
+#include "camera.hpp"
+#include "utils.hpp"
+
+// Keeps the image from before a camera motion so it is not lost when the camera settles somewhere
+// else. Capture stores the resolved image with its per pixel depth, Reproject splats it through the
+// depth into the new view, where it acts as a prior worth up to a few samples until fresh samples
+// take over. Reprojected shading is only exact for diffuse surfaces, hence the small weight.
+struct Reprojection {
+    // History in the current view, a weight of 0 marks pixels nothing was reprojected to
+    std::vector<Color> color;
+    std::vector<float> depth;
+    std::vector<float> weight;
+
+    std::vector<Color> anchor_color;
+    std::vector<float> anchor_depth;
+    std::vector<float> anchor_weight;
+    std::optional<Camera> anchor_camera;
+
+    bool empty() const {
+        return weight.empty();
+    }
+
+    void Clear() {
+        color.clear();
+        depth.clear();
+        weight.clear();
+    }
+
+    // resolve(i, color, depth) returns the sample weight of pixel i and its current color and depth
+    template <typename Resolve>
+    void Capture(const Camera& camera, ivec2 size, Resolve&& resolve) {
+        const size_t count = size_t(size.x) * size.y;
+        anchor_color.resize(count);
+        anchor_depth.resize(count);
+        anchor_weight.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            anchor_weight[i] = resolve(i, anchor_color[i], anchor_depth[i]);
+        }
+        anchor_camera = camera;
+    }
+
+    // Forward splats the anchor into camera's view with a depth test. Every point covers a 2x2
+    // footprint, which closes the cracks a 1:1 splat leaves when the camera moves closer.
+    void Reproject(const Camera& camera, ivec2 size, float max_weight) {
+        const size_t count = size_t(size.x) * size.y;
+        color.assign(count, Color{0.0f});
+        depth.assign(count, infinity);
+        weight.assign(count, 0.0f);
+
+        if (!anchor_camera || anchor_color.size() != count) {
+            return;
+        }
+
+        for (int y = 0; y < size.y; y++) {
+            for (int x = 0; x < size.x; x++) {
+                const size_t i = size_t(y) * size.x + x;
+                if (!std::isfinite(anchor_depth[i]) || anchor_weight[i] <= 0.0f) {
+                    continue;
+                }
+
+                const Ray ray = anchor_camera->get_ray((x + 0.5f) / size.x, (y + 0.5f) / size.y);
+                const vec3 point = ray.origin + anchor_depth[i] * ray.direction;
+
+                vec2 st;
+                float t;
+                if (!camera.project(point, st, t)) {
+                    continue;
+                }
+
+                const int x0 = int(std::floor(st.x * size.x - 0.5f));
+                const int y0 = int(std::floor(st.y * size.y - 0.5f));
+                for (int dy = 0; dy < 2; dy++) {
+                    for (int dx = 0; dx < 2; dx++) {
+                        const int px = x0 + dx;
+                        const int py = y0 + dy;
+                        if (px < 0 || py < 0 || px >= size.x || py >= size.y) {
+                            continue;
+                        }
+
+                        const size_t j = size_t(py) * size.x + px;
+                        if (t < depth[j]) {
+                            color[j] = anchor_color[i];
+                            depth[j] = t;
+                            weight[j] = std::min(anchor_weight[i], max_weight);
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+#include "utils.hpp"
+
+enum class SamplerType {
+    Random,
+    Sobol,
+};
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+inline uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return PCG_Hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// First two dimensions of the Sobol sequence, the most significant bit is the first digit
+inline uint32_t sobol(uint32_t index, int dimension) {
+    if (dimension == 0) {
+        return reverse_bits(index);
+    }
+
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            result ^= v;
+        }
+    }
+    return result;
+}
+
+// Hash based Owen scrambling, from Burley's "Practical Hash-based Owen Scrambling"
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x = laine_karras_permutation(x, seed);
+    return reverse_bits(x);
+}
+
+// Per pixel, per sample sample generator. The state only depends on the pixel, the sample index
+// and the seed, so every thread can own one and images do not depend on the scheduling.
+// The Sobol variant pads scrambled 2D Sobol points, every dimension pair gets its own shuffle.
+struct Sampler {
+    SamplerType type;
+    uint32_t pixel_seed;
+    uint32_t sample_index;
+    uint32_t dimension = 0;
+    uint32_t state;
+
+    Sampler() = default;
+
+    Sampler(SamplerType _type, ivec2 pixel, uint32_t _sample_index, uint32_t seed = 0)
+        : type{_type}, pixel_seed{hash_combine(hash_combine(seed, pixel.x), pixel.y)}, sample_index{_sample_index} {
+        state = hash_combine(pixel_seed, sample_index);
+    }
+
+    float Get1D() {
+        if (type == SamplerType::Random) {
+            return random_float(state);
+        }
+        return Get2D().x;
+    }
+
+    vec2 Get2D() {
+        if (type == SamplerType::Random) {
+            float x = random_float(state);
+            return vec2{x, random_float(state)};
+        }
+
+        const uint32_t dimension_seed = hash_combine(pixel_seed, dimension++);
+        const uint32_t index = nested_uniform_scramble(sample_index, dimension_seed);
+        const uint32_t x = nested_uniform_scramble(sobol(index, 0), hash_combine(dimension_seed, 0));
+        const uint32_t y = nested_uniform_scramble(sobol(index, 1), hash_combine(dimension_seed, 1));
+        return vec2{to_unit_float(x), to_unit_float(y)};
+    }
+};
@@ -1,52 +1,418 @@
 #pragma once
 
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#include "bvh.hpp"
+#include "environment.hpp"
 #include "material.hpp"
+#include "shape_soa.hpp"
 #include "shapes.hpp"
 
+// Position of T in Types
+template <typename T, typename... Types>
+constexpr uint32_t type_index() {
+    uint32_t index = 0;
+    bool found = false;
+    ((found = found || std::is_same_v<T, Types>, index += !found), ...);
+    return index;
+}
+
+// Calls f with the element of tuple at a runtime index. The if constexpr chain compiles to a few
+// compares and direct calls, there is no variant or function pointer in between.
+template <size_t I = 0, typename Tuple, typename F>
+auto select_type(Tuple& tuple, uint32_t type, F&& f) {
+    if constexpr (I + 1 < std::tuple_size_v<std::remove_const_t<Tuple>>) {
+        if (type != I) {
+            return select_type<I + 1>(tuple, type, f);
+        }
+    }
+    return f(std::get<I>(tuple));
+}
+
 template <typename TupleOne, typename TupleTwo>
 struct Scene;
 
+// Shapes and materials live in one contiguous array per type, the types are fixed at compile
+// time. Every loop over them is unrolled per type with a fold, so hits and shading never go
+// through a variant.
 template <typename... Shapes, typename... Materials>
 struct Scene<std::tuple<Shapes...>, std::tuple<Materials...>> {
-    struct Object {
-        int shape_idx;
-        int mat_idx;
+    static constexpr size_t shape_type_count = sizeof...(Shapes);
+    static constexpr size_t material_type_count = sizeof...(Materials);
+
+    // A single shape or material of any type, for loading and editing. The scene never stores these.
+    using Shape = std::variant<Shapes...>;
+    using Material = std::variant<Materials...>;
+
+    template <typename T>
+    static constexpr uint32_t shape_type = type_index<T, Shapes...>();
+    template <typename T>
+    static constexpr uint32_t material_type = type_index<T, Materials...>();
+
+    // An element of a per type array, type is the position in the type list
+    struct Ref {
+        uint32_t type;
+        uint32_t index;
+    };
+
+    // The objects of one shape type, materials and lights run parallel to shapes. lights holds the
+    // index into Scene::lights, or -1.
+    template <typename T>
+    struct Objects {
+        std::vector<T> shapes;
+        std::vector<Ref> materials;
+        std::vector<int> lights;
     };
 
-    std::vector<Object> objects;
-    std::vector<std::variant<Shapes...>> shapes;
-    std::vector<std::variant<Materials...>> materials;
+    struct Light {
+        Ref shape;
+        float select_pdf;
+    };
+
+    struct LightSample {
+        vec3 direction;
+        float distance;
+        Color emitted;
+        float pdf;
+    };
+
+    // Objects are numbered by shape type in type list order, then in the order they were added.
+    // The BVH, object_bounds and Refit use these numbers.
+    std::tuple<Objects<Shapes>...> objects;
+    std::tuple<std::vector<Materials>...> materials;
+    BVH bvh;
+    // Layout bookkeeping for refits: bounds and SoA slot of every object, and the cost of the fresh tree
+    std::vector<AABB> object_bounds;
+    std::vector<uint32_t> object_slots;
+    float built_cost = 0.0f;
+    std::tuple<ShapeSoA<Shapes>...> soa;
+    std::vector<Light> lights;
+    std::vector<float> light_cdf;
+    // Seen by rays that escape, empty for a black background
+    Environment environment;
 
     Scene() = default;
 
-    template <typename Shape, typename Mat>
-    void add(const Shape& shape, const Mat& material) {
-        objects.emplace_back(shapes.size(), materials.size());
-        shapes.emplace_back(shape);
-        materials.emplace_back(material);
+    template <typename S, typename M>
+    void add(const S& shape, const M& material) {
+        Objects<S>& array = std::get<Objects<S>>(objects);
+        std::vector<M>& material_array = std::get<std::vector<M>>(materials);
+        array.shapes.push_back(shape);
+        array.materials.push_back(Ref{material_type<M>, uint32_t(material_array.size())});
+        array.lights.push_back(-1);
+        material_array.push_back(material);
+    }
+
+    size_t ObjectCount() const {
+        return std::apply([](const auto&... arrays) { return (size_t(0) + ... + arrays.shapes.size()); }, objects);
+    }
+
+    // Calls f with the shape of an object
+    template <typename F>
+    auto VisitShape(uint32_t object, F&& f) const {
+        return FindObject(objects, object, [&](const auto& array, uint32_t i) { return f(array.shapes[i]); });
+    }
+
+    template <typename F>
+    auto VisitShape(uint32_t object, F&& f) {
+        return FindObject(objects, object, [&](auto& array, uint32_t i) { return f(array.shapes[i]); });
+    }
+
+    Ref MaterialOf(uint32_t object) const {
+        return FindObject(objects, object, [](const auto& array, uint32_t i) { return array.materials[i]; });
+    }
+
+    template <typename F>
+    auto VisitMaterial(Ref material, F&& f) const {
+        return select_type(materials, material.type, [&](const auto& array) { return f(array[material.index]); });
     }
 
-    bool Hit(const Ray& ray, float t_min, float t_max, hit_record& rec) {
-        hit_record temp_rec;
-        bool hit_anything = false;
+    // Calls f with the material of a hit
+    template <typename F>
+    auto VisitMaterial(const hit_record& rec, F&& f) const {
+        return VisitMaterial(Ref{uint32_t(rec.mat_type), uint32_t(rec.mat_index)}, f);
+    }
+
+    // Rebuilds the acceleration structure, call after adding objects
+    void Build() {
+        UpdateBounds();
+        bvh.Build(object_bounds);
+        BuildLayout();
+    }
+
+    // Derived per object data for the current BVH and object_bounds, enough on its own when the BVH comes prebuilt
+    void BuildLayout() {
+        object_slots.resize(ObjectCount());
+
+        // Lay the shapes out in leaf order so every leaf is a contiguous slot range
+        std::apply([&](auto&... arrays) { (arrays.Reset(bvh.indices.size()), ...); }, soa);
+        for (size_t slot = 0; slot < bvh.indices.size(); slot++) {
+            object_slots[bvh.indices[slot]] = slot;
+            SetSlot(slot);
+        }
+
+        built_cost = bvh.SAHCost();
+        BuildLights();
+    }
+
+    // Cheap update after the shapes of a few objects changed in place. The BVH is refit instead of
+    // rebuilt, until refitting has made it twice as expensive to traverse as a fresh build.
+    void Refit(const std::vector<uint32_t>& moved) {
+        if (moved.empty()) {
+            return;
+        }
+
+        bool lights_moved = false;
+        for (uint32_t object : moved) {
+            object_bounds[object] = VisitShape(object, [](const auto& shape) { return shape.Bounds(); });
+            SetSlot(object_slots[object]);
+            lights_moved |= FindObject(objects, object, [](const auto& array, uint32_t i) { return array.lights[i] >= 0; });
+        }
+
+        bvh.Refit(object_bounds);
+        if (bvh.SAHCost() > 2.0f * built_cost) {
+            Build();
+        } else if (lights_moved) {
+            BuildLights();
+        }
+    }
+
+    void UpdateBounds() {
+        object_bounds.clear();
+        object_bounds.reserve(ObjectCount());
+        auto append = [&](const auto& array) {
+            for (const auto& shape : array.shapes) {
+                object_bounds.push_back(shape.Bounds());
+            }
+        };
+        std::apply([&](const auto&... arrays) { (append(arrays), ...); }, objects);
+    }
+
+    void SetSlot(size_t slot) {
+        VisitShape(bvh.indices[slot], [&](const auto& shape) { std::get<ShapeSoA<std::decay_t<decltype(shape)>>>(soa).Set(slot, shape); });
+    }
+
+    // Every emissive object that can be sampled by area becomes a light, picked proportionally to its power
+    void BuildLights() {
+        lights.clear();
+        light_cdf.clear();
+        float total = 0.0f;
+
+        auto build = [&](auto& array, uint32_t type) {
+            for (uint32_t i = 0; i < array.shapes.size(); i++) {
+                array.lights[i] = -1;
+                float power = luminance(VisitMaterial(array.materials[i], [](const auto& mat) { return mat.emitted(); }));
+                float area = Area(array.shapes[i]);
+
+                if (power > 0.0f && area > 0.0f) {
+                    array.lights[i] = lights.size();
+                    lights.push_back(Light{Ref{type, i}, power * area});
+                    total += power * area;
+                    light_cdf.push_back(total);
+                }
+            }
+        };
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            (build(std::get<I>(objects), uint32_t(I)), ...);
+        }(std::index_sequence_for<Shapes...>{});
+
+        for (size_t i = 0; i < lights.size(); i++) {
+            lights[i].select_pdf /= total;
+            light_cdf[i] /= total;
+        }
+    }
+
+    // Chance that SampleLight picks the environment, the area lights share the rest
+    float EnvironmentSelectPdf() const {
+        if (environment.distribution.empty()) {
+            return 0.0f;
+        }
+        return lights.empty() ? 1.0f : 0.5f;
+    }
+
+    // Picks a light and a point on it as seen from a shading point, pdf is per solid angle
+    bool SampleLight(const vec3& from, const vec2& u_select, const vec2& u_point, LightSample& sample) const {
+        const float environment_pdf = EnvironmentSelectPdf();
+        if (u_select.x < environment_pdf) {
+            sample.distance = infinity;
+            if (!environment.Sample(vec2{u_select.x / environment_pdf, u_select.y}, u_point, sample.direction, sample.emitted, sample.pdf)) {
+                return false;
+            }
+            sample.pdf *= environment_pdf;
+            return true;
+        }
+
+        if (lights.empty()) {
+            return false;
+        }
+
+        const float u_light = (u_select.x - environment_pdf) / (1.0f - environment_pdf);
+        size_t light_idx = std::upper_bound(light_cdf.begin(), light_cdf.end(), u_light) - light_cdf.begin();
+        const Light& light = lights[std::min(light_idx, lights.size() - 1)];
+
+        return select_type(objects, light.shape.type, [&](const auto& array) {
+            const auto& shape = array.shapes[light.shape.index];
+            if constexpr (!requires { shape.Area(); }) {
+                return false;
+            } else {
+                vec3 normal;
+                vec3 point = shape.Sample(vec3{u_point.x, u_point.y, u_select.y}, normal);
+
+                vec3 to_light = point - from;
+                float distance_squared = dot(to_light, to_light);
+                sample.distance = std::sqrt(distance_squared);
+                sample.direction = to_light / sample.distance;
+
+                float area = shape.Area();
+                float cos_light = std::abs(dot(normal, sample.direction));
+                if (area <= 0.0f || cos_light <= 0.0f) {
+                    return false;
+                }
+
+                sample.pdf = light.select_pdf * (1.0f - environment_pdf) * distance_squared / (cos_light * area);
+                sample.emitted = VisitMaterial(array.materials[light.shape.index], [](const auto& mat) { return mat.emitted(); });
+                return true;
+            }
+        });
+    }
+
+    // Solid angle density with which SampleLight would have picked the hit point from the given origin
+    float LightPdf(const hit_record& rec, const vec3& from) const {
+        return select_type(objects, rec.shape_type, [&](const auto& array) {
+            const int light = array.lights[rec.shape_index];
+            if (light < 0) {
+                return 0.0f;
+            }
+
+            vec3 to_light = rec.point - from;
+            float distance_squared = dot(to_light, to_light);
+            float cos_light = std::abs(dot(rec.normal, to_light)) / std::sqrt(distance_squared);
+
+            return lights[light].select_pdf * (1.0f - EnvironmentSelectPdf()) * distance_squared / (cos_light * Area(array.shapes[rec.shape_index]));
+        });
+    }
+
+    // Solid angle density with which SampleLight would have picked an escaping direction
+    float EnvironmentPdf(const vec3& direction) const {
+        const float environment_pdf = EnvironmentSelectPdf();
+        return environment_pdf > 0.0f ? environment_pdf * environment.Pdf(direction) : 0.0f;
+    }
+
+    // Any hit query for shadow rays, stops at the first blocker
+    bool Occluded(const Ray& ray, float t_min, float t_max) const {
+        uint64_t tests = 0;
+        return Occluded(ray, t_min, t_max, tests);
+    }
+
+    // tests counts the primitives handed to the intersection kernels
+    bool Occluded(const Ray& ray, float t_min, float t_max, uint64_t& tests) const {
         float closest = t_max;
+        uint32_t hit_slot = 0;
+
+        return bvh.TraverseLeaves(ray, t_min, closest, [&](const BVHNode& leaf, float& closest_so_far) {
+            tests += leaf.count;
+            bool hit = std::apply(
+                [&](const auto&... arrays) {
+                    return (arrays.Hit(ray, t_min, closest_so_far, leaf.left_first, leaf.count, hit_slot) | ...);
+                },
+                soa);
+
+            // Collapsing the interval culls the rest of the traversal
+            if (hit) {
+                closest_so_far = t_min;
+            }
+            return hit;
+        });
+    }
+
+    bool Hit(const Ray& ray, float t_min, float t_max, hit_record& rec) const {
+        uint64_t tests = 0;
+        return Hit(ray, t_min, t_max, rec, tests);
+    }
+
+    bool Hit(const Ray& ray, float t_min, float t_max, hit_record& rec, uint64_t& tests) const {
+        float closest = t_max;
+        uint32_t hit_slot = 0;
+
+        bool hit = bvh.TraverseLeaves(ray, t_min, closest, [&](const BVHNode& leaf, float& closest_so_far) {
+            tests += leaf.count;
+            return std::apply(
+                [&](const auto&... arrays) {
+                    return (arrays.Hit(ray, t_min, closest_so_far, leaf.left_first, leaf.count, hit_slot) | ...);
+                },
+                soa);
+        });
 
-        for (const auto& object : objects) {
-            std::visit(
-                [&](const auto& obj) {
-                    if (obj.Hit(ray, t_min, closest, temp_rec)) {
-                        hit_anything = true;
-                        closest = temp_rec.t;
-                        rec = temp_rec;
-                        rec.mat_index = object.mat_idx;
-                    }
+        return hit && Record(ray, t_min, t_max, closest, hit_slot, rec);
+    }
+
+    // Closest hits of every ray in the packet, set up with packet.Add(ray, t_max) and Finish.
+    // hits[i] tells whether recs[i] holds the hit of the i-th ray.
+    void Hit(RayPacket& packet, float t_min, hit_record* recs, bool* hits, uint64_t& tests) const {
+        float t_max[RayPacket::max_size];
+        std::copy(packet.closest, packet.closest + packet.size, t_max);
+
+        bvh.TraversePacketLeaves(packet, t_min, [&](const BVHNode& leaf, int i) {
+            tests += leaf.count;
+            return std::apply(
+                [&](const auto&... arrays) {
+                    return (arrays.Hit(packet.rays[i], t_min, packet.closest[i], leaf.left_first, leaf.count, packet.hit_slot[i]) | ...);
                 },
-                shapes[object.shape_idx]);
+                soa);
+        });
+
+        for (int i = 0; i < packet.size; i++) {
+            hits[i] = packet.hit_slot[i] != RayPacket::no_hit && Record(packet.rays[i], t_min, t_max[i], packet.closest[i], packet.hit_slot[i], recs[i]);
         }
+    }
 
-        return hit_anything;
+  private:
+    // Only the nearest shape needs its full hit record. The SIMD kernels and the scalar test can
+    // disagree at grazing edges, then the record is built from the distance the kernel found.
+    bool Record(const Ray& ray, float t_min, float t_max, float t, uint32_t hit_slot, hit_record& rec) const {
+        return FindObject(objects, bvh.indices[hit_slot], [&](const auto& array, uint32_t i) {
+            const auto& shape = array.shapes[i];
+            if (!shape.Hit(ray, t_min, t_max, rec)) {
+                if constexpr (requires { shape.OutwardNormal(vec3{}); }) {
+                    rec.t = t;
+                    rec.point = ray.at(t);
+                    rec.set_face_normal(ray, shape.OutwardNormal(rec.point));
+                } else {
+                    return false;
+                }
+            }
+            rec.shape_type = shape_type<std::decay_t<decltype(array.shapes[i])>>;
+            rec.shape_index = i;
+            rec.mat_type = array.materials[i].type;
+            rec.mat_index = array.materials[i].index;
+            return true;
+        });
+    }
+
+    // Calls f with the per type array holding an object and the object's index in it
+    template <size_t I = 0, typename Tuple, typename F>
+    static auto FindObject(Tuple& arrays, uint32_t object, F&& f) {
+        auto& array = std::get<I>(arrays);
+        if constexpr (I + 1 < shape_type_count) {
+            if (object >= array.shapes.size()) {
+                return FindObject<I + 1>(arrays, object - uint32_t(array.shapes.size()), f);
+            }
+        }
+        return f(array, object);
+    }
+
+    // Shapes without an Area cannot be sampled and never become lights
+    template <typename T>
+    static float Area(const T& shape) {
+        if constexpr (requires { shape.Area(); }) {
+            return shape.Area();
+        } else {
+            return 0.0f;
+        }
     }
 };
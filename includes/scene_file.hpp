@@ -0,0 +1,679 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "camera.hpp"
+#include "environment.hpp"
+#include "mapped_file.hpp"
+#include "material.hpp"
+#include "mesh.hpp"
+#include "mesh_loader.hpp"
+#include "shapes.hpp"
+
+// Scenes come in two forms. The text form is meant to be written by hand:
+//
+//   camera <from x y z> <at x y z> <vfov>
+//   material <name> lambertian|metal|light <r g b>
+//   material <name> dielectric <ior>
+//   sphere <material> <center x y z> <radius>
+//   box <material> <min x y z> <max x y z>
+//   mesh <material> <path relative to the scene file> [offset x y z]
+//   environment <.hdr or .pfm path relative to the scene file> [intensity] [rotation degrees]
+//
+// The binary form is what raytracer_convert writes. Every section is a plain array of records
+// or of the in-memory BVH and mesh buffers, aligned to 64 bytes, so loading maps the file and
+// points the mesh and BVH buffers straight into it instead of parsing and rebuilding.
+namespace scene_file {
+
+constexpr char magic[8] = {'P', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+constexpr uint32_t version = 1;
+constexpr uint32_t endian_tag = 0x01020304;
+constexpr uint64_t section_alignment = 64;
+
+enum class SectionType : uint32_t {
+    Camera = 1,
+    Materials,
+    Objects,
+    Spheres,
+    Boxes,
+    MeshInstances,
+    BVHNodes,
+    BVHIndices,
+    MeshPositions,
+    MeshIndices,
+    MeshBVHNodes,
+    MeshBVHIndices,
+    Environment,
+    EnvironmentPixels,
+};
+
+enum class ShapeType : uint32_t { Sphere, Box, Mesh };
+enum class MaterialType : uint32_t { Metal, Lambertian, DiffuseLight, Dielectric };
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t section_count;
+    uint32_t reserved;
+};
+
+struct Section {
+    SectionType type;
+    uint32_t mesh;
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct CameraRecord {
+    vec3 look_from;
+    vec3 look_at;
+    vec3 vup;
+    float vfov;
+};
+
+struct MaterialRecord {
+    MaterialType type;
+    Color color;
+    float ior;
+};
+
+struct ObjectRecord {
+    ShapeType shape_type;
+    uint32_t shape;
+    uint32_t material;
+};
+
+struct SphereRecord {
+    vec3 center;
+    float radius;
+};
+
+struct BoxRecord {
+    vec3 min;
+    vec3 max;
+};
+
+struct MeshInstanceRecord {
+    uint32_t mesh;
+    vec3 offset;
+};
+
+// The pixels follow in their own section, the sampling tables are rebuilt on load
+struct EnvironmentRecord {
+    int32_t width;
+    int32_t height;
+    float intensity;
+    float rotation;
+};
+
+// Looks sections up in a mapped file, returning a null pointer when one is missing or out of bounds
+struct SectionReader {
+    const MappedFile& file;
+    const Section* sections;
+    uint32_t section_count;
+
+    template <typename T>
+    const T* Get(SectionType type, uint32_t mesh, size_t& count) const {
+        count = 0;
+        for (uint32_t i = 0; i < section_count; i++) {
+            const Section& section = sections[i];
+            if (section.type != type || section.mesh != mesh) {
+                continue;
+            }
+            if (section.offset > file.size || section.offset % alignof(T) != 0 || section.count > (file.size - section.offset) / sizeof(T)) {
+                return nullptr;
+            }
+            count = section.count;
+            return reinterpret_cast<const T*>(file.data + section.offset);
+        }
+        return nullptr;
+    }
+};
+
+// A mapped BVH is traversed without further checks, so every child, leaf range and primitive
+// index has to be in range and the tree no deeper than the traversal stack allows. Children
+// must come after their parent, as Build lays them out, which also rules out cycles.
+inline bool ValidBVH(const BVHNode* nodes, size_t node_count, const uint32_t* indices, size_t index_count, size_t primitive_count) {
+    if (node_count == 0) {
+        return false;
+    }
+
+    std::vector<int> depth(node_count, 0);
+    for (size_t i = 0; i < node_count; i++) {
+        const BVHNode& node = nodes[i];
+        if (node.is_leaf()) {
+            if (uint64_t(node.left_first) + node.count > index_count) {
+                return false;
+            }
+            continue;
+        }
+
+        if (node.left_first <= i || uint64_t(node.left_first) + 1 >= node_count || depth[i] >= BVH::max_depth) {
+            return false;
+        }
+        depth[node.left_first] = std::max(depth[node.left_first], depth[i] + 1);
+        depth[node.left_first + 1] = std::max(depth[node.left_first + 1], depth[i] + 1);
+    }
+
+    for (size_t i = 0; i < index_count; i++) {
+        if (indices[i] >= primitive_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+bool ToRecord(const T& mat, MaterialRecord& record) {
+    record = MaterialRecord{MaterialType::Metal, Color{0.0f}, 0.0f};
+    if constexpr (std::is_same_v<T, Metal>) {
+        record.color = mat.albedo;
+    } else if constexpr (std::is_same_v<T, Lambertian>) {
+        record.type = MaterialType::Lambertian;
+        record.color = mat.albedo;
+    } else if constexpr (std::is_same_v<T, DiffuseLight>) {
+        record.type = MaterialType::DiffuseLight;
+        record.color = mat.albedo;
+    } else if constexpr (std::is_same_v<T, Dielectric>) {
+        record.type = MaterialType::Dielectric;
+        record.ior = mat.ir;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+template <typename Material>
+bool FromRecord(const MaterialRecord& record, Material& material) {
+    switch (record.type) {
+        case MaterialType::Metal: material = Metal(record.color); return true;
+        case MaterialType::Lambertian: material = Lambertian(record.color); return true;
+        case MaterialType::DiffuseLight: material = DiffuseLight(record.color); return true;
+        case MaterialType::Dielectric: material = Dielectric(record.ior); return true;
+    }
+    return false;
+}
+
+inline CameraRecord ToRecord(const Camera& camera) {
+    return CameraRecord{camera.look_from, camera.look_at, camera.vup, camera.vfov};
+}
+
+inline void FromRecord(const CameraRecord& record, Camera& camera) {
+    camera.look_from = record.look_from;
+    camera.look_at = record.look_at;
+    camera.vup = record.vup;
+    camera.vfov = record.vfov;
+    camera.UpdateVectors();
+}
+
+}  // namespace scene_file
+
+template <typename World>
+bool LoadSceneText(const std::string& path, World& world, Camera& camera, std::string& error) {
+    std::ifstream file{path};
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    const size_t slash = path.find_last_of('/');
+    const std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+    std::map<std::string, typename World::Material> materials;
+    std::map<std::string, std::shared_ptr<MeshData>> meshes;
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(file, line)) {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream in{line};
+        std::string keyword;
+        if (!(in >> keyword)) {
+            continue;
+        }
+
+        auto fail = [&](const std::string& message) {
+            error = path + ":" + std::to_string(line_number) + ": " + message;
+            return false;
+        };
+
+        if (keyword == "camera") {
+            if (!(in >> camera.look_from.x >> camera.look_from.y >> camera.look_from.z >> camera.look_at.x >> camera.look_at.y >>
+                  camera.look_at.z >> camera.vfov)) {
+                return fail("expected camera <from x y z> <at x y z> <vfov>");
+            }
+            camera.UpdateVectors();
+            continue;
+        }
+
+        if (keyword == "environment") {
+            std::string image_path;
+            float intensity, rotation;
+            if (!(in >> image_path)) {
+                return fail("expected environment <path> [intensity] [rotation]");
+            }
+            // A failed read zeroes the value, the defaults go in afterwards
+            if (!(in >> intensity)) {
+                intensity = 1.0f;
+            }
+            if (!(in >> rotation)) {
+                rotation = 0.0f;
+            }
+
+            if (!world.environment.Load(image_path[0] == '/' ? image_path : directory + image_path, error)) {
+                return false;
+            }
+            world.environment.intensity = intensity;
+            world.environment.rotation = degrees_to_radians(rotation);
+            continue;
+        }
+
+        if (keyword == "material") {
+            std::string name, type;
+            Color color;
+            if (!(in >> name >> type)) {
+                return fail("expected material <name> <type> ...");
+            }
+
+            if (type == "dielectric") {
+                float ior;
+                if (!(in >> ior)) {
+                    return fail("expected dielectric <ior>");
+                }
+                materials[name] = Dielectric(ior);
+            } else if (!(in >> color.r >> color.g >> color.b)) {
+                return fail("expected " + type + " <r g b>");
+            } else if (type == "lambertian") {
+                materials[name] = Lambertian(color);
+            } else if (type == "metal") {
+                materials[name] = Metal(color);
+            } else if (type == "light") {
+                materials[name] = DiffuseLight(color);
+            } else {
+                return fail("unknown material type " + type);
+            }
+            continue;
+        }
+
+        if (keyword != "sphere" && keyword != "box" && keyword != "mesh") {
+            return fail("unknown keyword " + keyword);
+        }
+
+        std::string material_name;
+        if (!(in >> material_name)) {
+            return fail("expected " + keyword + " <material> ...");
+        }
+
+        auto material = materials.find(material_name);
+        if (material == materials.end()) {
+            return fail("unknown material " + material_name);
+        }
+
+        auto add = [&](const auto& shape) { std::visit([&](const auto& mat) { world.add(shape, mat); }, material->second); };
+
+        if (keyword == "sphere") {
+            vec3 center;
+            float radius;
+            if (!(in >> center.x >> center.y >> center.z >> radius)) {
+                return fail("expected sphere <material> <center x y z> <radius>");
+            }
+            add(Sphere(center, radius));
+        } else if (keyword == "box") {
+            vec3 min, max;
+            if (!(in >> min.x >> min.y >> min.z >> max.x >> max.y >> max.z)) {
+                return fail("expected box <material> <min x y z> <max x y z>");
+            }
+            add(Box(min, max));
+        } else {
+            std::string mesh_path;
+            vec3 offset{0.0f};
+            if (!(in >> mesh_path)) {
+                return fail("expected mesh <material> <path> [offset x y z]");
+            }
+            in >> offset.x >> offset.y >> offset.z;
+
+            auto& mesh = meshes[mesh_path];
+            if (!mesh) {
+                mesh = LoadMesh(mesh_path[0] == '/' ? mesh_path : directory + mesh_path, error);
+                if (!mesh) {
+                    return false;
+                }
+            }
+            add(TriangleMesh(mesh, offset));
+        }
+    }
+
+    world.Build();
+    return true;
+}
+
+template <typename World>
+bool WriteSceneBinary(const std::string& path, const World& world, const Camera& camera, std::string& error) {
+    using namespace scene_file;
+
+    struct Chunk {
+        SectionType type;
+        uint32_t mesh;
+        const void* data;
+        size_t element_size;
+        size_t count;
+    };
+
+    std::vector<MaterialRecord> materials;
+    std::map<std::tuple<uint32_t, float, float, float, float>, uint32_t> material_ids;
+    std::vector<ObjectRecord> objects;
+    std::vector<SphereRecord> spheres;
+    std::vector<BoxRecord> boxes;
+    std::vector<MeshInstanceRecord> instances;
+    std::vector<const MeshData*> meshes;
+    std::map<const MeshData*, uint32_t> mesh_ids;
+
+    for (uint32_t object = 0; object < world.ObjectCount(); object++) {
+        MaterialRecord material;
+        if (!world.VisitMaterial(world.MaterialOf(object), [&](const auto& mat) { return ToRecord(mat, material); })) {
+            error = "scene uses a material the file format does not know";
+            return false;
+        }
+
+        auto key = std::make_tuple(uint32_t(material.type), material.color.r, material.color.g, material.color.b, material.ior);
+        auto [it, inserted] = material_ids.emplace(key, materials.size());
+        if (inserted) {
+            materials.push_back(material);
+        }
+
+        ObjectRecord record{ShapeType::Sphere, 0, it->second};
+        bool known = world.VisitShape(object, [&](const auto& shape) {
+            using T = std::decay_t<decltype(shape)>;
+            if constexpr (std::is_same_v<T, Sphere>) {
+                record.shape = spheres.size();
+                spheres.push_back(SphereRecord{shape.center, shape.radius});
+            } else if constexpr (std::is_same_v<T, Box>) {
+                record.shape_type = ShapeType::Box;
+                record.shape = boxes.size();
+                boxes.push_back(BoxRecord{shape.min, shape.max});
+            } else if constexpr (std::is_same_v<T, TriangleMesh>) {
+                auto [mesh, added] = mesh_ids.emplace(shape.data.get(), meshes.size());
+                if (added) {
+                    meshes.push_back(shape.data.get());
+                }
+                record.shape_type = ShapeType::Mesh;
+                record.shape = instances.size();
+                instances.push_back(MeshInstanceRecord{mesh->second, shape.center});
+            } else {
+                return false;
+            }
+            return true;
+        });
+
+        if (!known) {
+            error = "scene uses a shape the file format does not know";
+            return false;
+        }
+        objects.push_back(record);
+    }
+
+    const CameraRecord camera_record = ToRecord(camera);
+    const Environment& environment = world.environment;
+    const EnvironmentRecord environment_record{environment.width, environment.height, environment.intensity, environment.rotation};
+
+    std::vector<Chunk> chunks = {
+        {SectionType::Camera, 0, &camera_record, sizeof(CameraRecord), 1},
+        {SectionType::Materials, 0, materials.data(), sizeof(MaterialRecord), materials.size()},
+        {SectionType::Objects, 0, objects.data(), sizeof(ObjectRecord), objects.size()},
+        {SectionType::Spheres, 0, spheres.data(), sizeof(SphereRecord), spheres.size()},
+        {SectionType::Boxes, 0, boxes.data(), sizeof(BoxRecord), boxes.size()},
+        {SectionType::MeshInstances, 0, instances.data(), sizeof(MeshInstanceRecord), instances.size()},
+        {SectionType::BVHNodes, 0, world.bvh.nodes.data(), sizeof(BVHNode), world.bvh.nodes.size()},
+        {SectionType::BVHIndices, 0, world.bvh.indices.data(), sizeof(uint32_t), world.bvh.indices.size()},
+    };
+
+    if (!environment.empty()) {
+        chunks.push_back({SectionType::Environment, 0, &environment_record, sizeof(EnvironmentRecord), 1});
+        chunks.push_back({SectionType::EnvironmentPixels, 0, environment.pixels.data(), sizeof(Color), environment.pixels.size()});
+    }
+
+    for (uint32_t i = 0; i < meshes.size(); i++) {
+        const MeshData& mesh = *meshes[i];
+        chunks.push_back({SectionType::MeshPositions, i, mesh.positions.data(), sizeof(vec3), mesh.positions.size()});
+        chunks.push_back({SectionType::MeshIndices, i, mesh.indices.data(), sizeof(uint32_t), mesh.indices.size()});
+        chunks.push_back({SectionType::MeshBVHNodes, i, mesh.bvh.nodes.data(), sizeof(BVHNode), mesh.bvh.nodes.size()});
+        chunks.push_back({SectionType::MeshBVHIndices, i, mesh.bvh.indices.data(), sizeof(uint32_t), mesh.bvh.indices.size()});
+    }
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        error = "cannot create " + path;
+        return false;
+    }
+
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.endian = endian_tag;
+    header.section_count = chunks.size();
+    header.reserved = 0;
+
+    auto align = [](uint64_t offset) { return (offset + section_alignment - 1) / section_alignment * section_alignment; };
+
+    std::vector<Section> sections;
+    uint64_t offset = align(sizeof(Header) + chunks.size() * sizeof(Section));
+    for (const Chunk& chunk : chunks) {
+        sections.push_back(Section{chunk.type, chunk.mesh, offset, chunk.count});
+        offset = align(offset + chunk.element_size * chunk.count);
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(sections.data(), sizeof(Section), sections.size(), file) == sections.size();
+
+    static const char padding[section_alignment] = {};
+    uint64_t written = sizeof(Header) + sections.size() * sizeof(Section);
+    for (size_t i = 0; i < chunks.size() && ok; i++) {
+        ok = std::fwrite(padding, 1, sections[i].offset - written, file) == sections[i].offset - written;
+        ok = ok && std::fwrite(chunks[i].data, chunks[i].element_size, chunks[i].count, file) == chunks[i].count;
+        written = sections[i].offset + chunks[i].element_size * chunks[i].count;
+    }
+
+    if (std::fclose(file) != 0 || !ok) {
+        error = "failed to write " + path;
+        return false;
+    }
+    return true;
+}
+
+template <typename World>
+bool LoadSceneBinary(const std::string& path, World& world, Camera& camera, std::string& error) {
+    using namespace scene_file;
+
+    auto file = std::make_shared<MappedFile>(path);
+    if (!file->valid()) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    Header header{};
+    if (file->size >= sizeof(Header)) {
+        std::memcpy(&header, file->data, sizeof(Header));
+    }
+
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        error = path + " is not a binary scene";
+        return false;
+    }
+
+    if (header.version != version || header.endian != endian_tag) {
+        error = path + " was written by an incompatible version or on a machine of different endianness";
+        return false;
+    }
+
+    if (file->size < sizeof(Header) + uint64_t(header.section_count) * sizeof(Section)) {
+        error = path + " is truncated";
+        return false;
+    }
+
+    const Section* sections = reinterpret_cast<const Section*>(file->data + sizeof(Header));
+    SectionReader reader{*file, sections, header.section_count};
+
+    size_t count;
+    if (const CameraRecord* record = reader.Get<CameraRecord>(SectionType::Camera, 0, count); record && count == 1) {
+        FromRecord(*record, camera);
+    }
+
+    if (const EnvironmentRecord* record = reader.Get<EnvironmentRecord>(SectionType::Environment, 0, count); record && count == 1) {
+        size_t pixel_count;
+        const Color* pixels = reader.Get<Color>(SectionType::EnvironmentPixels, 0, pixel_count);
+        if (!pixels || record->width <= 0 || record->height <= 0 || pixel_count != size_t(record->width) * record->height) {
+            error = path + ": environment is missing or malformed";
+            return false;
+        }
+        world.environment.Set(record->width, record->height, std::vector<Color>(pixels, pixels + pixel_count));
+        world.environment.intensity = record->intensity;
+        world.environment.rotation = record->rotation;
+    }
+
+    size_t material_count, object_count, sphere_count, box_count, instance_count;
+    const MaterialRecord* materials = reader.Get<MaterialRecord>(SectionType::Materials, 0, material_count);
+    const ObjectRecord* objects = reader.Get<ObjectRecord>(SectionType::Objects, 0, object_count);
+    const SphereRecord* spheres = reader.Get<SphereRecord>(SectionType::Spheres, 0, sphere_count);
+    const BoxRecord* boxes = reader.Get<BoxRecord>(SectionType::Boxes, 0, box_count);
+    const MeshInstanceRecord* instances = reader.Get<MeshInstanceRecord>(SectionType::MeshInstances, 0, instance_count);
+
+    if (!objects || !materials) {
+        error = path + " has no objects or materials";
+        return false;
+    }
+
+    // Mesh buffers stay in the mapping, the MeshData only views them
+    std::vector<std::shared_ptr<MeshData>> meshes;
+    for (size_t i = 0; instances && i < instance_count; i++) {
+        const uint32_t id = instances[i].mesh;
+        if (id < meshes.size()) {
+            continue;
+        }
+
+        size_t position_count, index_count, node_count, bvh_index_count;
+        const vec3* positions = reader.Get<vec3>(SectionType::MeshPositions, id, position_count);
+        const uint32_t* indices = reader.Get<uint32_t>(SectionType::MeshIndices, id, index_count);
+        const BVHNode* nodes = reader.Get<BVHNode>(SectionType::MeshBVHNodes, id, node_count);
+        const uint32_t* bvh_indices = reader.Get<uint32_t>(SectionType::MeshBVHIndices, id, bvh_index_count);
+
+        if (id != meshes.size() || !positions || !indices || !nodes || !bvh_indices || index_count % 3 != 0 || bvh_index_count != index_count / 3) {
+            error = path + ": mesh " + std::to_string(id) + " is missing or malformed";
+            return false;
+        }
+
+        for (size_t j = 0; j < index_count; j++) {
+            if (indices[j] >= position_count) {
+                error = path + ": mesh " + std::to_string(id) + " has an out of range index";
+                return false;
+            }
+        }
+
+        if (!ValidBVH(nodes, node_count, bvh_indices, bvh_index_count, index_count / 3)) {
+            error = path + ": mesh " + std::to_string(id) + " has a malformed BVH";
+            return false;
+        }
+
+        auto mesh = std::make_shared<MeshData>();
+        mesh->positions.Map(positions, position_count, file);
+        mesh->indices.Map(indices, index_count, file);
+        mesh->bvh.nodes.Map(nodes, node_count, file);
+        mesh->bvh.indices.Map(bvh_indices, bvh_index_count, file);
+        meshes.push_back(std::move(mesh));
+    }
+
+    // The scene numbers objects by shape type, a file in any other order cannot use its BVH
+    bool grouped = true;
+    uint32_t last_type = 0;
+    auto add = [&](const auto& shape, const auto& mat) {
+        const uint32_t type = World::template shape_type<std::decay_t<decltype(shape)>>;
+        grouped = grouped && type >= last_type;
+        last_type = type;
+        world.add(shape, mat);
+    };
+
+    for (size_t i = 0; i < object_count; i++) {
+        const ObjectRecord& object = objects[i];
+        typename World::Material material;
+
+        if (object.material >= material_count || !FromRecord(materials[object.material], material)) {
+            error = path + ": object " + std::to_string(i) + " has a bad material";
+            return false;
+        }
+
+        bool ok = std::visit(
+            [&](const auto& mat) {
+                switch (object.shape_type) {
+                    case ShapeType::Sphere:
+                        if (!spheres || object.shape >= sphere_count) return false;
+                        add(Sphere(spheres[object.shape].center, spheres[object.shape].radius), mat);
+                        return true;
+                    case ShapeType::Box:
+                        if (!boxes || object.shape >= box_count) return false;
+                        add(Box(boxes[object.shape].min, boxes[object.shape].max), mat);
+                        return true;
+                    case ShapeType::Mesh:
+                        if (!instances || object.shape >= instance_count || instances[object.shape].mesh >= meshes.size()) return false;
+                        add(TriangleMesh(meshes[instances[object.shape].mesh], instances[object.shape].offset), mat);
+                        return true;
+                }
+                return false;
+            },
+            material);
+
+        if (!ok) {
+            error = path + ": object " + std::to_string(i) + " has a bad shape";
+            return false;
+        }
+    }
+
+    // Reuse the prebuilt top level BVH when it matches the objects
+    size_t node_count, index_count;
+    const BVHNode* nodes = reader.Get<BVHNode>(SectionType::BVHNodes, 0, node_count);
+    const uint32_t* indices = reader.Get<uint32_t>(SectionType::BVHIndices, 0, index_count);
+
+    const bool prebuilt = grouped && nodes && indices && node_count > 0 && index_count == object_count;
+    if (prebuilt && !ValidBVH(nodes, node_count, indices, index_count, object_count)) {
+        error = path + " has a malformed BVH";
+        return false;
+    }
+
+    if (prebuilt) {
+        world.bvh.nodes.Map(nodes, node_count, file);
+        world.bvh.indices.Map(indices, index_count, file);
+        world.UpdateBounds();
+        world.BuildLayout();
+    } else {
+        world.Build();
+    }
+
+    return true;
+}
+
+// Binary scenes are recognized by their magic, everything else is read as text
+template <typename World>
+bool LoadScene(const std::string& path, World& world, Camera& camera, std::string& error) {
+    char file_magic[sizeof(scene_file::magic)] = {};
+    if (FILE* file = std::fopen(path.c_str(), "rb")) {
+        size_t read = std::fread(file_magic, 1, sizeof(file_magic), file);
+        std::fclose(file);
+        if (read == sizeof(file_magic) && std::memcmp(file_magic, scene_file::magic, sizeof(file_magic)) == 0) {
+            return LoadSceneBinary(path, world, camera, error);
+        }
+    }
+    return LoadSceneText(path, world, camera, error);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "material.hpp"
+#include "mesh_loader.hpp"
+#include "shapes.hpp"
+
+template <typename World>
+void DefaultScene(World& world) {
+    auto ground_material = Lambertian(Color{0.3, 0.2, 0.1});
+    auto white_light = DiffuseLight(Color{1.0, 0.91, 0.81} * vec3{10.0f});
+    auto metal = Metal(Color{0.8, 0.8, 0.8});
+    auto lambertian = Lambertian(Color{1.0, 0.8, 1.0});
+    auto dielectric = Dielectric(1.5);
+
+    world.add(Sphere(vec3{0.0f, -100.5f, -1.0f}, 100.0f), ground_material);
+    world.add(Sphere(vec3{0.0f, 7.0f, -12.0f}, 8.0f), white_light);
+
+    world.add(Box(vec3(0, -0.5, -1), vec3(1, 3.0, 0)), white_light);
+    world.add(Box(vec3(-2.5, -0.5, -3.5), vec3(-1.5, 0.5, -2.5)), white_light);
+
+    world.add(Sphere(vec3{0.5f, 0.0f, -2.0f}, 0.5f), metal);
+    world.add(Sphere(vec3{-1.0f, 0.0f, -2.0f}, 0.5f), dielectric);
+    world.add(Sphere(vec3{-1.0f, 0.0f, -0.5f}, 0.5f), lambertian);
+
+    world.Build();
+}
+
+// Loads every mesh with a neutral diffuse material, returns false if one of them failed
+template <typename World>
+bool AddMeshes(World& world, const std::vector<std::string>& paths) {
+    bool ok = true;
+
+    for (const auto& path : paths) {
+        std::string error;
+        auto mesh = LoadMesh(path, error);
+        if (!mesh) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            ok = false;
+            continue;
+        }
+
+        std::printf("%s: %zu triangles\n", path.c_str(), mesh->triangle_count());
+        world.add(TriangleMesh(mesh), Lambertian(Color{0.7f}));
+    }
+
+    world.Build();
+    return ok;
+}
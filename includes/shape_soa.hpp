@@ -0,0 +1,364 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "shapes.hpp"
+#include "simd.hpp"
+
+// Structure of arrays copies of the scene shapes, one slot per entry of BVH::indices so a BVH
+// leaf maps to the same slot range in every shape type. Slots holding another shape type stay
+// inert and never report a hit.
+//
+// Hit tests the slots [first, first + count) and returns true when one of them is closer than
+// closest, storing the distance in closest and the slot in hit_slot.
+
+// Fallback for shapes without a vectorized kernel
+template <typename Shape>
+struct ShapeSoA {
+    std::vector<Shape> items;
+    std::vector<uint8_t> present;
+
+    void Reset(size_t slots) {
+        items.assign(slots, Shape{});
+        present.assign(slots, 0);
+    }
+
+    void Set(size_t slot, const Shape& shape) {
+        items[slot] = shape;
+        present[slot] = 1;
+    }
+
+    bool Hit(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        hit_record rec;
+        bool hit = false;
+        for (uint32_t i = first; i < first + count; i++) {
+            if (present[i] && items[i].Hit(ray, t_min, closest, rec) && rec.t < closest) {
+                closest = rec.t;
+                hit_slot = i;
+                hit = true;
+            }
+        }
+        return hit;
+    }
+};
+
+template <>
+struct ShapeSoA<Sphere> {
+    aligned_vector<float> center_x, center_y, center_z, radius;
+
+    // Inert slots have a NaN radius, so their discriminant test always fails
+    void Reset(size_t slots) {
+        const size_t padded = slots + max_simd_width;
+        center_x.assign(padded, 0.0f);
+        center_y.assign(padded, 0.0f);
+        center_z.assign(padded, 0.0f);
+        radius.assign(padded, std::numeric_limits<float>::quiet_NaN());
+    }
+
+    void Set(size_t slot, const Sphere& sphere) {
+        center_x[slot] = sphere.center.x;
+        center_y[slot] = sphere.center.y;
+        center_z[slot] = sphere.center.z;
+        radius[slot] = sphere.radius;
+    }
+
+    bool Hit(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+#if RAYTRACER_SIMD_WIDTH == 8
+        return HitAvx2(ray, t_min, closest, first, count, hit_slot);
+#elif RAYTRACER_SIMD_WIDTH == 4 && RAYTRACER_MULTIVERSION
+        return cpu::isa >= Isa::Avx2 ? HitAvx2(ray, t_min, closest, first, count, hit_slot) : HitSse2(ray, t_min, closest, first, count, hit_slot);
+#elif RAYTRACER_SIMD_WIDTH == 4
+        return HitSse2(ray, t_min, closest, first, count, hit_slot);
+#else
+        return HitScalar(ray, t_min, closest, first, count, hit_slot);
+#endif
+    }
+
+  private:
+#if RAYTRACER_MULTIVERSION || RAYTRACER_SIMD_WIDTH == 8
+    RAYTRACER_TARGET_AVX2 bool HitAvx2(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        const uint32_t end = first + count;
+        const float a = dot(ray.direction, ray.direction);
+        bool hit = false;
+
+        const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+        const __m256 dx = _mm256_set1_ps(ray.direction.x), dy = _mm256_set1_ps(ray.direction.y), dz = _mm256_set1_ps(ray.direction.z);
+        const __m256 va = _mm256_set1_ps(a);
+        const __m256 tmin = _mm256_set1_ps(t_min);
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (uint32_t i = first; i < end; i += 8) {
+            const __m256 tmax = _mm256_set1_ps(closest);
+            const __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&center_x[i]));
+            const __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&center_y[i]));
+            const __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&center_z[i]));
+            const __m256 r = _mm256_loadu_ps(&radius[i]);
+
+            const __m256 half_b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+            const __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+            const __m256 c = _mm256_sub_ps(oc2, _mm256_mul_ps(r, r));
+            const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(half_b, half_b), _mm256_mul_ps(va, c));
+            const __m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+
+            const __m256 neg_b = _mm256_sub_ps(zero, half_b);
+            const __m256 t0 = _mm256_div_ps(_mm256_sub_ps(neg_b, sqrtd), va);
+            const __m256 t1 = _mm256_div_ps(_mm256_add_ps(neg_b, sqrtd), va);
+            const __m256 use_t0 = _mm256_cmp_ps(t0, tmin, _CMP_GE_OQ);
+            const __m256 t = _mm256_blendv_ps(t1, t0, use_t0);
+
+            __m256 valid = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmin, _CMP_GE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmax, _CMP_LT_OQ));
+
+            unsigned mask = _mm256_movemask_ps(valid);
+            if (end - i < 8) {
+                mask &= (1u << (end - i)) - 1;
+            }
+
+            if (mask) {
+                alignas(32) float ts[8];
+                _mm256_store_ps(ts, t);
+                const int lane = nearest_lane(mask, ts);
+                closest = ts[lane];
+                hit_slot = i + lane;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+#endif
+#if RAYTRACER_SIMD_WIDTH == 4
+    bool HitSse2(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        const uint32_t end = first + count;
+        const float a = dot(ray.direction, ray.direction);
+        bool hit = false;
+
+        const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+        const __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+        const __m128 va = _mm_set1_ps(a);
+        const __m128 tmin = _mm_set1_ps(t_min);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (uint32_t i = first; i < end; i += 4) {
+            const __m128 tmax = _mm_set1_ps(closest);
+            const __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&center_x[i]));
+            const __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&center_y[i]));
+            const __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&center_z[i]));
+            const __m128 r = _mm_loadu_ps(&radius[i]);
+
+            const __m128 half_b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+            const __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+            const __m128 c = _mm_sub_ps(oc2, _mm_mul_ps(r, r));
+            const __m128 disc = _mm_sub_ps(_mm_mul_ps(half_b, half_b), _mm_mul_ps(va, c));
+            const __m128 sqrtd = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+
+            const __m128 neg_b = _mm_sub_ps(zero, half_b);
+            const __m128 t0 = _mm_div_ps(_mm_sub_ps(neg_b, sqrtd), va);
+            const __m128 t1 = _mm_div_ps(_mm_add_ps(neg_b, sqrtd), va);
+            const __m128 use_t0 = _mm_cmpge_ps(t0, tmin);
+            const __m128 t = _mm_or_ps(_mm_and_ps(use_t0, t0), _mm_andnot_ps(use_t0, t1));
+
+            __m128 valid = _mm_cmpge_ps(disc, zero);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(t, tmin));
+            valid = _mm_and_ps(valid, _mm_cmplt_ps(t, tmax));
+
+            unsigned mask = _mm_movemask_ps(valid);
+            if (end - i < 4) {
+                mask &= (1u << (end - i)) - 1;
+            }
+
+            if (mask) {
+                alignas(16) float ts[4];
+                _mm_store_ps(ts, t);
+                const int lane = nearest_lane(mask, ts);
+                closest = ts[lane];
+                hit_slot = i + lane;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+#elif RAYTRACER_SIMD_WIDTH == 1
+    bool HitScalar(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        const uint32_t end = first + count;
+        const float a = dot(ray.direction, ray.direction);
+        bool hit = false;
+
+        for (uint32_t i = first; i < end; i++) {
+            const vec3 oc = ray.origin - vec3{center_x[i], center_y[i], center_z[i]};
+            const float half_b = dot(oc, ray.direction);
+            const float c = dot(oc, oc) - radius[i] * radius[i];
+            const float disc = half_b * half_b - a * c;
+            if (!(disc >= 0.0f)) {
+                continue;
+            }
+
+            const float sqrtd = std::sqrt(disc);
+            const float t0 = (-half_b - sqrtd) / a;
+            const float t = t0 >= t_min ? t0 : (-half_b + sqrtd) / a;
+            if (t >= t_min && t < closest) {
+                closest = t;
+                hit_slot = i;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+#endif
+};
+
+template <>
+struct ShapeSoA<Box> {
+    aligned_vector<float> min_x, min_y, min_z, max_x, max_y, max_z;
+
+    // Inert slots sit at infinity, every distance they produce is infinite and fails t < closest
+    void Reset(size_t slots) {
+        const size_t padded = slots + max_simd_width;
+        const float inf = std::numeric_limits<float>::infinity();
+        for (auto* v : {&min_x, &min_y, &min_z, &max_x, &max_y, &max_z}) {
+            v->assign(padded, inf);
+        }
+    }
+
+    void Set(size_t slot, const Box& box) {
+        min_x[slot] = box.min.x;
+        min_y[slot] = box.min.y;
+        min_z[slot] = box.min.z;
+        max_x[slot] = box.max.x;
+        max_y[slot] = box.max.y;
+        max_z[slot] = box.max.z;
+    }
+
+    bool Hit(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+#if RAYTRACER_SIMD_WIDTH == 8
+        return HitAvx2(ray, t_min, closest, first, count, hit_slot);
+#elif RAYTRACER_SIMD_WIDTH == 4 && RAYTRACER_MULTIVERSION
+        return cpu::isa >= Isa::Avx2 ? HitAvx2(ray, t_min, closest, first, count, hit_slot) : HitSse2(ray, t_min, closest, first, count, hit_slot);
+#elif RAYTRACER_SIMD_WIDTH == 4
+        return HitSse2(ray, t_min, closest, first, count, hit_slot);
+#else
+        return HitScalar(ray, t_min, closest, first, count, hit_slot);
+#endif
+    }
+
+  private:
+#if RAYTRACER_MULTIVERSION || RAYTRACER_SIMD_WIDTH == 8
+    RAYTRACER_TARGET_AVX2 bool HitAvx2(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        const uint32_t end = first + count;
+        bool hit = false;
+
+        const __m256 ox = _mm256_set1_ps(ray.origin.x), oy = _mm256_set1_ps(ray.origin.y), oz = _mm256_set1_ps(ray.origin.z);
+        const __m256 ix = _mm256_set1_ps(ray.inv_direction.x), iy = _mm256_set1_ps(ray.inv_direction.y), iz = _mm256_set1_ps(ray.inv_direction.z);
+        const __m256 tmin = _mm256_set1_ps(t_min);
+
+        for (uint32_t i = first; i < end; i += 8) {
+            const __m256 tmax = _mm256_set1_ps(closest);
+            const __m256 t0x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&min_x[i]), ox), ix);
+            const __m256 t0y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&min_y[i]), oy), iy);
+            const __m256 t0z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&min_z[i]), oz), iz);
+            const __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&max_x[i]), ox), ix);
+            const __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&max_y[i]), oy), iy);
+            const __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&max_z[i]), oz), iz);
+
+            const __m256 tenter = _mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_max_ps(_mm256_min_ps(t0y, t1y), _mm256_min_ps(t0z, t1z)));
+            const __m256 texit = _mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_min_ps(_mm256_max_ps(t0y, t1y), _mm256_max_ps(t0z, t1z)));
+
+            const __m256 inside = _mm256_cmp_ps(tenter, tmin, _CMP_LT_OQ);
+            const __m256 t = _mm256_blendv_ps(tenter, texit, inside);
+
+            __m256 valid = _mm256_cmp_ps(tenter, texit, _CMP_LE_OQ);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmin, _CMP_GE_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, tmax, _CMP_LT_OQ));
+
+            unsigned mask = _mm256_movemask_ps(valid);
+            if (end - i < 8) {
+                mask &= (1u << (end - i)) - 1;
+            }
+
+            if (mask) {
+                alignas(32) float ts[8];
+                _mm256_store_ps(ts, t);
+                const int lane = nearest_lane(mask, ts);
+                closest = ts[lane];
+                hit_slot = i + lane;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+#endif
+#if RAYTRACER_SIMD_WIDTH == 4
+    bool HitSse2(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        const uint32_t end = first + count;
+        bool hit = false;
+
+        const __m128 ox = _mm_set1_ps(ray.origin.x), oy = _mm_set1_ps(ray.origin.y), oz = _mm_set1_ps(ray.origin.z);
+        const __m128 ix = _mm_set1_ps(ray.inv_direction.x), iy = _mm_set1_ps(ray.inv_direction.y), iz = _mm_set1_ps(ray.inv_direction.z);
+        const __m128 tmin = _mm_set1_ps(t_min);
+
+        for (uint32_t i = first; i < end; i += 4) {
+            const __m128 tmax = _mm_set1_ps(closest);
+            const __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&min_x[i]), ox), ix);
+            const __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&min_y[i]), oy), iy);
+            const __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&min_z[i]), oz), iz);
+            const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&max_x[i]), ox), ix);
+            const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&max_y[i]), oy), iy);
+            const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&max_z[i]), oz), iz);
+
+            const __m128 tenter = _mm_max_ps(_mm_min_ps(t0x, t1x), _mm_max_ps(_mm_min_ps(t0y, t1y), _mm_min_ps(t0z, t1z)));
+            const __m128 texit = _mm_min_ps(_mm_max_ps(t0x, t1x), _mm_min_ps(_mm_max_ps(t0y, t1y), _mm_max_ps(t0z, t1z)));
+
+            const __m128 inside = _mm_cmplt_ps(tenter, tmin);
+            const __m128 t = _mm_or_ps(_mm_and_ps(inside, texit), _mm_andnot_ps(inside, tenter));
+
+            __m128 valid = _mm_cmple_ps(tenter, texit);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(t, tmin));
+            valid = _mm_and_ps(valid, _mm_cmplt_ps(t, tmax));
+
+            unsigned mask = _mm_movemask_ps(valid);
+            if (end - i < 4) {
+                mask &= (1u << (end - i)) - 1;
+            }
+
+            if (mask) {
+                alignas(16) float ts[4];
+                _mm_store_ps(ts, t);
+                const int lane = nearest_lane(mask, ts);
+                closest = ts[lane];
+                hit_slot = i + lane;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+#elif RAYTRACER_SIMD_WIDTH == 1
+    bool HitScalar(const Ray& ray, float t_min, float& closest, uint32_t first, uint32_t count, uint32_t& hit_slot) const {
+        const uint32_t end = first + count;
+        bool hit = false;
+
+        for (uint32_t i = first; i < end; i++) {
+            const vec3 t0s = (vec3{min_x[i], min_y[i], min_z[i]} - ray.origin) * ray.inv_direction;
+            const vec3 t1s = (vec3{max_x[i], max_y[i], max_z[i]} - ray.origin) * ray.inv_direction;
+            const vec3 tsmaller = glm::min(t0s, t1s);
+            const vec3 tbigger = glm::max(t0s, t1s);
+            const float tenter = std::max(tsmaller.x, std::max(tsmaller.y, tsmaller.z));
+            const float texit = std::min(tbigger.x, std::min(tbigger.y, tbigger.z));
+            const float t = tenter < t_min ? texit : tenter;
+
+            if (tenter <= texit && t >= t_min && t < closest) {
+                closest = t;
+                hit_slot = i;
+                hit = true;
+            }
+        }
+
+        return hit;
+    }
+#endif
+};
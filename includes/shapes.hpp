@@ -1,28 +1,29 @@
 #pragma once
 
+#include "aabb.hpp"
 #include "hit_record.hpp"
+#include "sampling.hpp"
 
 struct Sphere {
     vec3 center;
     float radius;
-    int mat_index;
 
     Sphere() = default;
 
     Sphere(vec3 _center, float _radius) : center{_center}, radius{_radius} {}
 
-    bool Hit(const Ray& ray, double t_min, double t_max, hit_record& rec) const {
+    bool Hit(const Ray& ray, float t_min, float t_max, hit_record& rec) const {
         vec3 oc = ray.origin - center;
-        auto a = dot(ray.direction, ray.direction);
-        auto half_b = dot(oc, ray.direction);
-        auto c = dot(oc, oc) - radius * radius;
+        float a = dot(ray.direction, ray.direction);
+        float half_b = dot(oc, ray.direction);
+        float c = dot(oc, oc) - radius * radius;
 
-        auto discriminant = half_b * half_b - a * c;
-        if (discriminant < 0)
+        float discriminant = half_b * half_b - a * c;
+        if (discriminant < 0.0f)
             return false;
-        auto sqrtd = sqrt(discriminant);
+        float sqrtd = std::sqrt(discriminant);
 
-        auto root = (-half_b - sqrtd) / a;
+        float root = (-half_b - sqrtd) / a;
         if (root < t_min || t_max < root) {
             root = (-half_b + sqrtd) / a;
             if (root < t_min || t_max < root) {
@@ -34,15 +35,30 @@ struct Sphere {
         rec.point = ray.at(rec.t);
         vec3 outward_normal = (rec.point - center) / radius;
         rec.set_face_normal(ray, outward_normal);
-        rec.mat_index = mat_index;
 
         return true;
     }
+
+    AABB Bounds() const {
+        return AABB{center - vec3{radius}, center + vec3{radius}};
+    }
+
+    vec3 OutwardNormal(const vec3& point) const {
+        return (point - center) / radius;
+    }
+
+    float Area() const {
+        return 4.0f * float(pi) * radius * radius;
+    }
+
+    // Uniformly distributed point on the surface, u.z is unused
+    vec3 Sample(const vec3& u, vec3& normal) const {
+        normal = uniform_sphere(vec2{u.x, u.y});
+        return center + radius * normal;
+    }
 };
 
 struct Box {
-    int mat_index;
-    vec3 center;
     vec3 min;
     vec3 max;
 
@@ -51,9 +67,8 @@ struct Box {
     Box(const vec3& p0, const vec3& p1) : min{p0}, max{p1} {}
 
     bool Hit(const Ray& ray, float t_min, float t_max, hit_record& rec) const {
-        vec3 inv_direction = 1.0f / ray.direction;
-        vec3 t0s = (min - ray.origin) * inv_direction;
-        vec3 t1s = (max - ray.origin) * inv_direction;
+        vec3 t0s = (min - ray.origin) * ray.inv_direction;
+        vec3 t1s = (max - ray.origin) * ray.inv_direction;
 
         vec3 tsmaller = glm::min(t0s, t1s);
         vec3 tbigger = glm::max(t0s, t1s);
@@ -61,23 +76,93 @@ struct Box {
         float tenter = std::max(tsmaller.x, std::max(tsmaller.y, tsmaller.z));
         float texit = std::min(tbigger.x, std::min(tbigger.y, tbigger.z));
 
-        if (tenter < texit && texit > t_min && tenter < t_max) {
-            rec.t = tenter;
-            rec.point = ray.at(rec.t);
-
-            vec3 outward_normal;
-            if (tsmaller.x == tenter)
-                outward_normal = vec3(1, 0, 0);
-            else if (tsmaller.y == tenter)
-                outward_normal = vec3(0, 1, 0);
-            else
-                outward_normal = vec3(0, 0, 1);
-
-            rec.set_face_normal(ray, outward_normal);
-            rec.mat_index = mat_index;
-            return true;
+        // Rays starting inside the box hit it on the way out
+        bool inside = tenter < t_min;
+        float t = inside ? texit : tenter;
+
+        if (tenter > texit || t < t_min || t_max < t) {
+            return false;
         }
 
-        return false;
+        rec.t = t;
+        rec.point = ray.at(rec.t);
+
+        int axis;
+        if (inside)
+            axis = tbigger.x == t ? 0 : (tbigger.y == t ? 1 : 2);
+        else
+            axis = tsmaller.x == t ? 0 : (tsmaller.y == t ? 1 : 2);
+
+        // Entering through a face means travelling against its outward normal
+        vec3 outward_normal{0.0f};
+        outward_normal[axis] = (ray.direction[axis] < 0.0f) != inside ? 1.0f : -1.0f;
+
+        rec.set_face_normal(ray, outward_normal);
+        return true;
+    }
+
+    AABB Bounds() const {
+        return AABB{glm::min(min, max), glm::max(min, max)};
+    }
+
+    vec3 Center() const {
+        return (min + max) * 0.5f;
+    }
+
+    void Translate(const vec3& offset) {
+        min += offset;
+        max += offset;
+    }
+
+    // Normal of the face nearest to a point on the surface
+    vec3 OutwardNormal(const vec3& point) const {
+        const AABB bounds = Bounds();
+        vec3 normal{0.0f};
+        float nearest = std::numeric_limits<float>::infinity();
+        for (int axis = 0; axis < 3; axis++) {
+            const float to_min = std::abs(point[axis] - bounds.min[axis]);
+            const float to_max = std::abs(point[axis] - bounds.max[axis]);
+            if (std::min(to_min, to_max) < nearest) {
+                nearest = std::min(to_min, to_max);
+                normal = vec3{0.0f};
+                normal[axis] = to_min < to_max ? -1.0f : 1.0f;
+            }
+        }
+        return normal;
+    }
+
+    float Area() const {
+        vec3 e = glm::abs(max - min);
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    // Uniformly distributed point on the surface, u.z picks the face
+    vec3 Sample(const vec3& u, vec3& normal) const {
+        vec3 e = glm::abs(max - min);
+        vec3 face_areas{e.y * e.z, e.x * e.z, e.x * e.y};
+        float pick = u.z * (face_areas.x + face_areas.y + face_areas.z);
+
+        int axis = 0;
+        if (pick >= face_areas.x) {
+            pick -= face_areas.x;
+            axis = pick < face_areas.y ? 1 : 2;
+            if (axis == 2) {
+                pick -= face_areas.y;
+            }
+        }
+
+        // Reuse what is left of the pick to choose between the two opposite faces
+        bool upper = pick >= 0.5f * face_areas[axis];
+        int a1 = (axis + 1) % 3;
+        int a2 = (axis + 2) % 3;
+
+        vec3 point;
+        point[axis] = upper ? max[axis] : min[axis];
+        point[a1] = min[a1] + u.x * (max[a1] - min[a1]);
+        point[a2] = min[a2] + u.y * (max[a2] - min[a2]);
+
+        normal = vec3{0.0f};
+        normal[axis] = (upper == (max[axis] > min[axis])) ? 1.0f : -1.0f;
+        return point;
     }
 };
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "cpu.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RAYTRACER_SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RAYTRACER_SIMD_WIDTH 4
+#else
+#define RAYTRACER_SIMD_WIDTH 1
+#endif
+
+// The AVX2 kernels are compiled with a target attribute, which needs their intrinsics declared
+// whatever the compiler flags
+#if RAYTRACER_MULTIVERSION
+#include <immintrin.h>
+#endif
+
+constexpr int simd_width = RAYTRACER_SIMD_WIDTH;
+// Widest kernel any dispatch level runs, structure of arrays data is padded for it
+constexpr int max_simd_width = RAYTRACER_MULTIVERSION && simd_width < 8 ? 8 : simd_width;
+
+// Width of the leaf kernels the level cpu::isa selected runs, which can exceed simd_width
+inline int active_simd_width() {
+#if RAYTRACER_MULTIVERSION
+    if (simd_width == 4 && cpu::isa >= Isa::Avx2) {
+        return 8;
+    }
+#endif
+    return simd_width;
+}
+
+template <typename T, size_t Alignment = 32>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void* ptr = std::aligned_alloc(Alignment, bytes);
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) {
+        std::free(ptr);
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const {
+        return true;
+    }
+};
+
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+// Index of the smallest t among the lanes set in mask, mask must not be zero
+inline int nearest_lane(unsigned mask, const float* t) {
+    int best = __builtin_ctz(mask);
+    for (mask &= mask - 1; mask; mask &= mask - 1) {
+        int lane = __builtin_ctz(mask);
+        if (t[lane] < t[best]) {
+            best = lane;
+        }
+    }
+    return best;
+}
+
+// Treats denormals as zero on the calling thread while alive. Kernels whose weights decay towards
+// zero otherwise spend most of their time in the slow path denormal arithmetic takes.
+struct FlushDenormals {
+#if RAYTRACER_SIMD_WIDTH > 1
+    const unsigned saved = _mm_getcsr();
+
+    FlushDenormals() {
+        // Flush to zero and denormals are zero
+        _mm_setcsr(saved | 0x8040);
+    }
+
+    ~FlushDenormals() {
+        _mm_setcsr(saved);
+    }
+#endif
+};
+
+// One register of floats, for kernels that read better written once than once per instruction set
+struct vfloat {
+    static constexpr int width = simd_width;
+
+#if RAYTRACER_SIMD_WIDTH == 8
+    __m256 v;
+
+    static vfloat load(const float* p) {
+        return {_mm256_loadu_ps(p)};
+    }
+    static vfloat broadcast(float x) {
+        return {_mm256_set1_ps(x)};
+    }
+    void store(float* p) const {
+        _mm256_storeu_ps(p, v);
+    }
+
+    friend vfloat operator+(vfloat a, vfloat b) {
+        return {_mm256_add_ps(a.v, b.v)};
+    }
+    friend vfloat operator-(vfloat a, vfloat b) {
+        return {_mm256_sub_ps(a.v, b.v)};
+    }
+    friend vfloat operator*(vfloat a, vfloat b) {
+        return {_mm256_mul_ps(a.v, b.v)};
+    }
+    friend vfloat operator/(vfloat a, vfloat b) {
+        return {_mm256_div_ps(a.v, b.v)};
+    }
+    friend vfloat min(vfloat a, vfloat b) {
+        return {_mm256_min_ps(a.v, b.v)};
+    }
+    friend vfloat max(vfloat a, vfloat b) {
+        return {_mm256_max_ps(a.v, b.v)};
+    }
+    friend vfloat abs(vfloat a) {
+        return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};
+    }
+    friend vfloat sqrt(vfloat a) {
+        return {_mm256_sqrt_ps(a.v)};
+    }
+    // Bit i set where lane i of a <= b
+    friend unsigned less_equal_mask(vfloat a, vfloat b) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));
+    }
+    // 2^n for integral valued n in the normal exponent range
+    static vfloat exp2_int(vfloat n) {
+        const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127)), 23);
+        return {_mm256_castsi256_ps(bits)};
+    }
+    static vfloat round(vfloat a) {
+        return {_mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)};
+    }
+#elif RAYTRACER_SIMD_WIDTH == 4
+    __m128 v;
+
+    static vfloat load(const float* p) {
+        return {_mm_loadu_ps(p)};
+    }
+    static vfloat broadcast(float x) {
+        return {_mm_set1_ps(x)};
+    }
+    void store(float* p) const {
+        _mm_storeu_ps(p, v);
+    }
+
+    friend vfloat operator+(vfloat a, vfloat b) {
+        return {_mm_add_ps(a.v, b.v)};
+    }
+    friend vfloat operator-(vfloat a, vfloat b) {
+        return {_mm_sub_ps(a.v, b.v)};
+    }
+    friend vfloat operator*(vfloat a, vfloat b) {
+        return {_mm_mul_ps(a.v, b.v)};
+    }
+    friend vfloat operator/(vfloat a, vfloat b) {
+        return {_mm_div_ps(a.v, b.v)};
+    }
+    friend vfloat min(vfloat a, vfloat b) {
+        return {_mm_min_ps(a.v, b.v)};
+    }
+    friend vfloat max(vfloat a, vfloat b) {
+        return {_mm_max_ps(a.v, b.v)};
+    }
+    friend vfloat abs(vfloat a) {
+        return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+    }
+    friend vfloat sqrt(vfloat a) {
+        return {_mm_sqrt_ps(a.v)};
+    }
+    friend unsigned less_equal_mask(vfloat a, vfloat b) {
+        return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+    }
+    static vfloat exp2_int(vfloat n) {
+        const __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127)), 23);
+        return {_mm_castsi128_ps(bits)};
+    }
+    // SSE2 has no rounding instruction, the conversion rounds to nearest
+    static vfloat round(vfloat a) {
+        return {_mm_cvtepi32_ps(_mm_cvtps_epi32(a.v))};
+    }
+#else
+    float v;
+
+    static vfloat load(const float* p) {
+        return {*p};
+    }
+    static vfloat broadcast(float x) {
+        return {x};
+    }
+    void store(float* p) const {
+        *p = v;
+    }
+
+    friend vfloat operator+(vfloat a, vfloat b) {
+        return {a.v + b.v};
+    }
+    friend vfloat operator-(vfloat a, vfloat b) {
+        return {a.v - b.v};
+    }
+    friend vfloat operator*(vfloat a, vfloat b) {
+        return {a.v * b.v};
+    }
+    friend vfloat operator/(vfloat a, vfloat b) {
+        return {a.v / b.v};
+    }
+    friend vfloat min(vfloat a, vfloat b) {
+        return {std::min(a.v, b.v)};
+    }
+    friend vfloat max(vfloat a, vfloat b) {
+        return {std::max(a.v, b.v)};
+    }
+    friend vfloat abs(vfloat a) {
+        return {std::fabs(a.v)};
+    }
+    friend vfloat sqrt(vfloat a) {
+        return {std::sqrt(a.v)};
+    }
+    friend unsigned less_equal_mask(vfloat a, vfloat b) {
+        return a.v <= b.v;
+    }
+    static vfloat exp2_int(vfloat n) {
+        return {std::ldexp(1.0f, int(n.v))};
+    }
+    static vfloat round(vfloat a) {
+        return {std::nearbyint(a.v)};
+    }
+#endif
+};
+
+// e^x to about 1e-6 relative error for x <= 0, inputs below -87 flush towards 0.
+// Splits x log2(e) into an integer, which goes straight into the exponent bits, and a fraction in
+// [-0.5, 0.5] whose power of two a polynomial handles.
+inline vfloat fast_exp(vfloat x) {
+    const vfloat t = max(x, vfloat::broadcast(-87.0f)) * vfloat::broadcast(1.44269504f);
+    const vfloat n = vfloat::round(t);
+    const vfloat f = (t - n) * vfloat::broadcast(0.69314718f);
+
+    // Taylor series of e^f up to f^6 / 720
+    vfloat p = vfloat::broadcast(1.0f / 720.0f);
+    p = p * f + vfloat::broadcast(1.0f / 120.0f);
+    p = p * f + vfloat::broadcast(1.0f / 24.0f);
+    p = p * f + vfloat::broadcast(1.0f / 6.0f);
+    p = p * f + vfloat::broadcast(0.5f);
+    p = p * f + vfloat::broadcast(1.0f);
+    p = p * f + vfloat::broadcast(1.0f);
+    return p * vfloat::exp2_int(n);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <utility>
+
+// Blocking stream socket. Addresses are either host:port for TCP or unix:path for a Unix domain socket.
+struct Socket {
+    int fd = -1;
+
+    Socket() = default;
+
+    explicit Socket(int descriptor) : fd{descriptor} {}
+
+    ~Socket() {
+        Close();
+    }
+
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    Socket(Socket&& other) : fd{std::exchange(other.fd, -1)} {}
+
+    Socket& operator=(Socket&& other) {
+        std::swap(fd, other.fd);
+        return *this;
+    }
+
+    bool valid() const {
+        return fd >= 0;
+    }
+
+    void Close() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    bool SendAll(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            // A peer that went away must not kill the process with SIGPIPE
+            const ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                return false;
+            }
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool ReceiveAll(void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            const ssize_t received = recv(fd, bytes, size, 0);
+            if (received <= 0) {
+                return false;
+            }
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool Send(const T& value) {
+        return SendAll(&value, sizeof(T));
+    }
+
+    template <typename T>
+    bool Receive(T& value) {
+        return ReceiveAll(&value, sizeof(T));
+    }
+
+    // Makes sends and receives that wait longer than seconds fail, 0 waits forever
+    void SetTimeout(int seconds) {
+        timeval timeout{seconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    // Waits up to timeout_ms for a connection, returns an invalid socket when none arrived
+    Socket Accept(int timeout_ms) {
+        pollfd waiting{fd, POLLIN, 0};
+        if (poll(&waiting, 1, timeout_ms) <= 0) {
+            return Socket{};
+        }
+
+        Socket client{accept(fd, nullptr, nullptr)};
+        client.NoDelay();
+        return client;
+    }
+
+    static Socket Listen(const std::string& address, std::string& error) {
+        return Open(address, true, error);
+    }
+
+    static Socket Connect(const std::string& address, std::string& error) {
+        return Open(address, false, error);
+    }
+
+  private:
+    // Work items and results are small messages, waiting to batch them only adds latency
+    void NoDelay() {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    static Socket Open(const std::string& address, bool listening, std::string& error) {
+        if (address.rfind("unix:", 0) == 0) {
+            const std::string path = address.substr(5);
+            sockaddr_un addr{};
+            if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+                error = "bad unix socket path in " + address;
+                return Socket{};
+            }
+            addr.sun_family = AF_UNIX;
+            std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+            Socket socket{::socket(AF_UNIX, SOCK_STREAM, 0)};
+            if (listening) {
+                unlink(path.c_str());
+            }
+            if (!socket.valid() || !socket.Establish(reinterpret_cast<sockaddr*>(&addr), sizeof(addr), listening)) {
+                error = std::string(listening ? "cannot listen on " : "cannot connect to ") + address + ": " + std::strerror(errno);
+                return Socket{};
+            }
+            return socket;
+        }
+
+        const size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            error = "expected host:port or unix:path, got " + address;
+            return Socket{};
+        }
+        const std::string host = address.substr(0, colon);
+        const std::string port = address.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        addrinfo* results = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0) {
+            error = "cannot resolve " + address;
+            return Socket{};
+        }
+
+        Socket socket;
+        for (addrinfo* info = results; info && !socket.valid(); info = info->ai_next) {
+            Socket candidate{::socket(info->ai_family, info->ai_socktype, info->ai_protocol)};
+            if (candidate.valid() && candidate.Establish(info->ai_addr, info->ai_addrlen, listening)) {
+                socket = std::move(candidate);
+            }
+        }
+        freeaddrinfo(results);
+
+        if (!socket.valid()) {
+            error = std::string(listening ? "cannot listen on " : "cannot connect to ") + address + ": " + std::strerror(errno);
+            return Socket{};
+        }
+        if (!listening) {
+            socket.NoDelay();
+        }
+        return socket;
+    }
+
+    // Binds and listens, or connects
+    bool Establish(const sockaddr* addr, socklen_t length, bool listening) {
+        if (!listening) {
+            return connect(fd, addr, length) == 0;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        return bind(fd, addr, length) == 0 && listen(fd, 64) == 0;
+    }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent workers that live as long as the pool. Every ParallelFor hands each worker a
+// contiguous range of task indices, workers pop from the front of their own range and steal
+// from the back of the others once they run dry, so uneven tasks do not leave cores idle.
+struct ThreadPool {
+    using Job = std::function<void(uint32_t task, unsigned worker)>;
+
+    ThreadPool(unsigned worker_count = std::thread::hardware_concurrency()) {
+        Start(worker_count);
+    }
+
+    ~ThreadPool() {
+        Stop();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const {
+        return thread_count;
+    }
+
+    void Resize(unsigned worker_count) {
+        Stop();
+        Start(worker_count);
+    }
+
+    // Runs job(task, worker) for every task in [0, task_count) and blocks until all are done
+    void ParallelFor(uint32_t task_count, const Job& job) {
+        if (task_count == 0) {
+            return;
+        }
+
+        std::unique_lock lock{mutex};
+        done_cv.wait(lock, [&] { return active == 0; });
+
+        const uint32_t worker_count = thread_count;
+        const uint32_t per_worker = task_count / worker_count;
+        const uint32_t remainder = task_count % worker_count;
+
+        uint32_t begin = 0;
+        for (uint32_t i = 0; i < worker_count; i++) {
+            uint32_t end = begin + per_worker + (i < remainder ? 1 : 0);
+            queues[i].begin = begin;
+            queues[i].end = end;
+            begin = end;
+        }
+
+        current_job = &job;
+        pending = task_count;
+        generation++;
+        lock.unlock();
+        start_cv.notify_all();
+
+        lock.lock();
+        done_cv.wait(lock, [&] { return pending == 0 && active == 0; });
+        current_job = nullptr;
+    }
+
+  private:
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        uint32_t begin = 0;
+        uint32_t end = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<WorkQueue[]> queues;
+    unsigned thread_count = 0;
+
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const Job* current_job = nullptr;
+    uint64_t generation = 0;
+    unsigned active = 0;
+    bool stopping = false;
+    std::atomic<uint32_t> pending = 0;
+
+    void Start(unsigned worker_count) {
+        thread_count = std::max(worker_count, 1u);
+        queues = std::make_unique<WorkQueue[]>(thread_count);
+        stopping = false;
+
+        workers.reserve(thread_count);
+        for (unsigned i = 0; i < thread_count; i++) {
+            workers.emplace_back([this, i, start_generation = generation] { WorkerLoop(i, start_generation); });
+        }
+    }
+
+    void Stop() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        start_cv.notify_all();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    bool PopOwn(unsigned worker, uint32_t& task) {
+        WorkQueue& queue = queues[worker];
+        std::lock_guard lock{queue.mutex};
+        if (queue.begin == queue.end) {
+            return false;
+        }
+        task = queue.begin++;
+        return true;
+    }
+
+    bool Steal(unsigned thief, uint32_t& task) {
+        for (unsigned offset = 1; offset < thread_count; offset++) {
+            WorkQueue& queue = queues[(thief + offset) % thread_count];
+            std::lock_guard lock{queue.mutex};
+            if (queue.begin != queue.end) {
+                task = --queue.end;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(unsigned worker, uint64_t seen_generation) {
+        while (true) {
+            const Job* job;
+            {
+                std::unique_lock lock{mutex};
+                start_cv.wait(lock, [&] { return stopping || generation != seen_generation; });
+                if (stopping) {
+                    return;
+                }
+                seen_generation = generation;
+                job = current_job;
+                active++;
+            }
+
+            uint32_t task;
+            while (PopOwn(worker, task) || Steal(worker, task)) {
+                (*job)(task, worker);
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+            }
+
+            {
+                std::lock_guard lock{mutex};
+                active--;
+            }
+            done_cv.notify_all();
+        }
+    }
+};
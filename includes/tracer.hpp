@@ -0,0 +1,652 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <array>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "camera.hpp"
+#include "cpu.hpp"
+#include "denoiser.hpp"
+#include "integrator.hpp"
+#include "mesh.hpp"
+#include "packet.hpp"
+#include "profiler.hpp"
+#include "reprojection.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "shapes.hpp"
+#include "thread_pool.hpp"
+#include "wavefront.hpp"
+
+// Adaptive sampling stops tracing a tile once the standard error of every pixel mean, relative to
+// the pixel's luminance plus an offset that keeps near black pixels from needing endless samples,
+// is below threshold. Tiles are the unit so the remaining work stays coherent.
+struct AdaptiveSettings {
+    bool enabled = false;
+    float threshold = 0.01f;
+    int min_samples = 16;
+    float luminance_offset = 0.1f;
+};
+
+// While the camera moves frames are previews at reduced resolution, sized to stay within the budget.
+// Once it settles the image from before the motion is reprojected and refined at full size.
+struct InteractiveSettings {
+    bool enabled = true;
+    float preview_budget_ms = 30.0f;
+    int max_preview_scale = 8;
+    float history_weight = 8.0f;
+};
+
+// Display pixel in the byte order GL_RGBA with GL_UNSIGNED_BYTE expects
+struct Rgba8 {
+    uint8_t r, g, b, a;
+};
+
+// The tracing core shared by the interactive window and the offline renderer.
+// pixels holds the linear running mean of every sample taken so far, variance the running mean and
+// sum of squared deviations (Welford) of the clamped luminance the per pixel error comes from.
+struct Tracer {
+    using Objects = std::tuple<Sphere, Box, TriangleMesh>;
+    using Materials = std::tuple<Metal, Lambertian, DiffuseLight, Dielectric>;
+    using World = Scene<Objects, Materials>;
+
+    static constexpr const char* material_names[] = {"Metal", "Lambertian", "DiffuseLight", "Dielectric"};
+    static_assert(World::material_type_count <= PathCounters::max_material_types);
+
+    Camera camera;
+    ivec2 texture_size{0, 0};
+    PathSettings settings;
+    AdaptiveSettings adaptive;
+    InteractiveSettings interactive;
+    DenoiseSettings denoise;
+    // Passes taken since the accumulation restarted, setting it to 0 restarts
+    int samples = 0;
+    int tile_size = 16;
+    uint32_t seed = 0;
+    SamplerType sampler_type = SamplerType::Sobol;
+    Integrator integrator = Integrator::Recursive;
+
+    std::vector<Color> pixels;
+    struct LuminanceMoments {
+        float mean = 0.0f;
+        float m2 = 0.0f;
+    };
+    std::vector<LuminanceMoments> variance;
+    // First hit distance of each pixel's latest sample, in units of its camera ray direction
+    std::vector<float> pixel_depth;
+    // Mean first hit albedo and normal, only accumulated while denoising
+    std::vector<Color> feature_albedo;
+    std::vector<vec3> feature_normal;
+    Denoiser denoiser;
+    std::vector<Color> denoised;
+    // Samples and error of each tile, tiles are sampled independently in adaptive mode
+    ivec2 tile_grid{0, 0};
+    int grid_tile_size = 0;
+    std::vector<uint32_t> tile_samples;
+    std::vector<float> tile_errors;
+    std::vector<uint32_t> active_tiles;
+
+    Reprojection history;
+    bool keep_history = false;
+    std::optional<Camera> last_camera;
+    bool moving = false;
+    int preview_scale = 1;
+    ivec2 preview_size{0, 0};
+    std::vector<Color> preview;
+
+    // Per worker statistics of the last frame, total sums every frame so far
+    std::vector<PathCounters> counters;
+    PathCounters total;
+    uint64_t frame_ns = 0;
+    Profiler profiler;
+    std::vector<Wavefront<World>> wavefronts;
+    ThreadPool pool;
+    World world;
+
+    // Edits land in a staged copy of the shapes and are copied into world between frames, so workers
+    // never read a shape while it changes. Only the edited objects are updated and the BVH is refit.
+    std::mutex edit_mutex;
+    std::vector<typename World::Shape> staged_shapes;
+    std::vector<uint32_t> edited_objects;
+
+    Tracer(float aspect_ratio, unsigned workers = std::thread::hardware_concurrency()) : camera{aspect_ratio}, pool{workers} {}
+
+    Color& Pixel(int x, int y) {
+        return pixels[y * texture_size.x + x];
+    }
+
+    void Resize(int w, int h) {
+        texture_size = {w, h};
+        pixels.assign(texture_size.x * texture_size.y, Color{0.0f});
+        variance.assign(pixels.size(), LuminanceMoments{});
+        pixel_depth.assign(pixels.size(), infinity);
+        feature_albedo.assign(pixels.size(), Color{0.0f});
+        feature_normal.assign(pixels.size(), vec3{0.0f});
+        denoised.clear();
+        history = Reprojection{};
+        last_camera.reset();
+        moving = false;
+        samples = 0;
+    }
+
+    typename World::Shape StagedShape(uint32_t object) {
+        std::lock_guard lock{edit_mutex};
+        SyncStaging();
+        return staged_shapes[object];
+    }
+
+    void EditObject(uint32_t object, const typename World::Shape& shape) {
+        std::lock_guard lock{edit_mutex};
+        SyncStaging();
+        staged_shapes[object] = shape;
+        if (std::find(edited_objects.begin(), edited_objects.end(), object) == edited_objects.end()) {
+            edited_objects.push_back(object);
+        }
+    }
+
+    // Publishes staged edits to world and restarts the accumulation, only call between frames
+    bool ApplyEdits() {
+        std::lock_guard lock{edit_mutex};
+        if (edited_objects.empty()) {
+            return false;
+        }
+
+        for (uint32_t object : edited_objects) {
+            world.VisitShape(object, [&](auto& shape) { shape = std::get<std::decay_t<decltype(shape)>>(staged_shapes[object]); });
+        }
+        world.Refit(edited_objects);
+        edited_objects.clear();
+        samples = 0;
+        return true;
+    }
+
+    bool TileActive(uint32_t tile) const {
+        return !adaptive.enabled || tile_samples[tile] < uint32_t(adaptive.min_samples) || tile_errors[tile] >= adaptive.threshold;
+    }
+
+    // True once adaptive sampling has nothing left to do
+    bool Converged() const {
+        if (!adaptive.enabled || samples == 0 || tile_samples.empty()) {
+            return false;
+        }
+        for (uint32_t tile = 0; tile < tile_samples.size(); tile++) {
+            if (TileActive(tile)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // False while another MakePixels would not change the image
+    bool HasWork() {
+        if (moving || (last_camera && !last_camera->same_view(camera))) {
+            return true;
+        }
+        {
+            std::lock_guard lock{edit_mutex};
+            if (!edited_objects.empty()) {
+                return true;
+            }
+        }
+        return !Converged();
+    }
+
+    float ConvergedFraction() const {
+        if (tile_samples.empty()) {
+            return 0.0f;
+        }
+        uint32_t converged = 0;
+        for (uint32_t tile = 0; tile < tile_samples.size(); tile++) {
+            converged += !TileActive(tile);
+        }
+        return float(converged) / tile_samples.size();
+    }
+
+    PathCounters Counters() const {
+        return total;
+    }
+
+    PathCounters FrameCounters() const {
+        PathCounters frame;
+        for (const auto& counter : counters) {
+            frame += counter;
+        }
+        return frame;
+    }
+
+    // features receives the camera ray's first hit for reprojection and denoising
+    Color RayColor(const Ray& ray, Sampler& sampler, PathCounters& counter, PathFeatures& features) const {
+        hit_record rec;
+        const bool hit = settings.max_depth > 0 && world.Hit(ray, 0.001, infinity, rec, counter.intersection_tests);
+        return RayColor(ray, hit ? &rec : nullptr, sampler, counter, features);
+    }
+
+    // Continues a path whose first intersection is already known, primary is null when the ray escaped
+    Color RayColor(const Ray& ray, const hit_record* primary, Sampler& sampler, PathCounters& counter, PathFeatures& features) const {
+        PathState path;
+        path.ray = ray;
+
+        for (int depth = 0; depth < settings.max_depth; depth++) {
+            hit_record rec;
+
+            counter.CountRay(depth);
+            if (depth == 0) {
+                if (!primary) {
+                    ShadeMiss(world, settings, path);
+                    break;
+                }
+                rec = *primary;
+            } else if (!world.Hit(path.ray, 0.001, infinity, rec, counter.intersection_tests)) {
+                ShadeMiss(world, settings, path);
+                break;
+            }
+            counter.material_hits[rec.mat_type]++;
+
+            ShadowRay shadow;
+            bool has_shadow;
+            bool alive =
+                world.VisitMaterial(rec, [&](const auto& mat) { return ShadeHit(world, mat, rec, depth, settings, path, sampler, shadow, has_shadow, counter); });
+
+            if (has_shadow && !world.Occluded(shadow.ray, 0.001, shadow.t_max, counter.intersection_tests)) {
+                path.radiance += shadow.contribution;
+            }
+
+            if (!alive) {
+                break;
+            }
+        }
+
+        features = path.features;
+        return path.radiance;
+    }
+
+    // Adds one sample to every pixel of every tile that still needs one
+    void MakePixels() {
+        // The old image shows a different scene after an edit
+        if (ApplyEdits()) {
+            history = Reprojection{};
+        }
+
+        const bool camera_moved = last_camera && !last_camera->same_view(camera);
+        if (camera_moved && interactive.enabled) {
+            if (!moving) {
+                history.Capture(*last_camera, texture_size, [&](size_t i, Color& color, float& distance) { return Resolve(i, color, distance); });
+                const float full_frame_ms = frame_ns * 1e-6f;
+                preview_scale = std::clamp(int(std::ceil(std::sqrt(full_frame_ms / interactive.preview_budget_ms))), 1, interactive.max_preview_scale);
+                moving = true;
+            }
+            last_camera = camera;
+            RenderPreview();
+            return;
+        }
+
+        if (camera_moved) {
+            samples = 0;
+        }
+        last_camera = camera;
+
+        if (moving) {
+            moving = false;
+            history.Reproject(camera, texture_size, interactive.history_weight);
+            samples = 0;
+            keep_history = true;
+        }
+
+        const ivec2 grid{(texture_size.x + tile_size - 1) / tile_size, (texture_size.y + tile_size - 1) / tile_size};
+
+        // Tiles with differing sample counts cannot be regrouped, a new grid restarts them
+        if (grid != tile_grid) {
+            bool uniform = std::all_of(tile_samples.begin(), tile_samples.end(), [&](uint32_t n) { return n == tile_samples[0]; });
+            if (!uniform) {
+                samples = 0;
+            }
+            tile_grid = grid;
+            grid_tile_size = tile_size;
+            tile_samples.assign(grid.x * grid.y, samples);
+            tile_errors.assign(grid.x * grid.y, infinity);
+        }
+
+        if (samples == 0) {
+            std::fill(tile_samples.begin(), tile_samples.end(), 0);
+            std::fill(tile_errors.begin(), tile_errors.end(), infinity);
+            if (!keep_history) {
+                history.Clear();
+            }
+            keep_history = false;
+        }
+
+        active_tiles.clear();
+        for (uint32_t tile = 0; tile < tile_samples.size(); tile++) {
+            if (TileActive(tile)) {
+                active_tiles.push_back(tile);
+            }
+        }
+
+        counters.assign(pool.size(), PathCounters{});
+        frame_ns = 0;
+        if (active_tiles.empty()) {
+            return;
+        }
+        samples++;
+
+        if (integrator == Integrator::Wavefront) {
+            wavefronts.resize(pool.size());
+        }
+
+        profiler.Reserve(pool.size());
+        const uint64_t frame_start = profiler.Now();
+
+        pool.ParallelFor(active_tiles.size(), [&](uint32_t task, unsigned worker) {
+            const uint64_t tile_start = profiler.Now();
+            const uint32_t tile = active_tiles[task];
+            const int x0 = (tile % grid.x) * tile_size;
+            const int y0 = (tile / grid.x) * tile_size;
+            const int x1 = std::min(x0 + tile_size, texture_size.x);
+            const int y1 = std::min(y0 + tile_size, texture_size.y);
+            const uint32_t sample_index = tile_samples[tile]++;
+            PathCounters counter;
+            float error = 0.0f;
+
+            TraceTile({x0, y0}, {x1, y1}, sample_index, worker, counter, [&](int x, int y, const Color& color, const PathFeatures& features) {
+                error = std::max(error, Accumulate(x, y, color, features, sample_index + 1));
+            });
+            tile_errors[tile] = error;
+
+            const uint64_t tile_end = profiler.Now();
+            counter.busy_ns = tile_end - tile_start;
+            counters[worker] += counter;
+            profiler.Record(worker, "tile", tile_start, tile_end, tile);
+        });
+
+        FinishFrame("MakePixels", frame_start);
+    }
+
+    // Traces sample sample_index of every pixel in [tile_min, tile_max) and hands the results to
+    // sink(x, y, color, features). The tile runs compiled for the instruction set cpu::isa picks.
+    template <typename Sink>
+    void TraceTile(ivec2 tile_min, ivec2 tile_max, uint32_t sample_index, unsigned worker, PathCounters& counter, Sink&& sink) {
+        cpu::dispatch([&] { TraceTileKernel(tile_min, tile_max, sample_index, worker, counter, sink); });
+    }
+
+    template <typename Sink>
+    void TraceTileKernel(ivec2 tile_min, ivec2 tile_max, uint32_t sample_index, unsigned worker, PathCounters& counter, Sink& sink) {
+        if (integrator == Integrator::Wavefront) {
+            Wavefront<World>& wavefront = wavefronts[worker];
+            wavefront.Generate(camera, texture_size, tile_min, tile_max, sampler_type, sample_index, seed);
+            wavefront.Trace(world, settings, counter);
+
+            for (int y = tile_min.y, i = 0; y < tile_max.y; y++) {
+                for (int x = tile_min.x; x < tile_max.x; x++, i++) {
+                    sink(x, y, wavefront.Radiance(i), wavefront.Features(i));
+                }
+            }
+        } else if (settings.packets && settings.max_depth > 0) {
+            // The camera rays of every 8x8 block traverse the BVH as one packet, the paths diverge
+            // after the first hit and continue one ray at a time
+            RayPacket packet;
+            std::array<Sampler, RayPacket::max_size> samplers;
+            std::array<hit_record, RayPacket::max_size> recs;
+            bool hits[RayPacket::max_size];
+
+            for (int by = tile_min.y; by < tile_max.y; by += RayPacket::side) {
+                for (int bx = tile_min.x; bx < tile_max.x; bx += RayPacket::side) {
+                    const ivec2 block_max = min(ivec2{bx, by} + RayPacket::side, tile_max);
+                    packet.Clear();
+                    for (int y = by; y < block_max.y; y++) {
+                        for (int x = bx; x < block_max.x; x++) {
+                            Sampler& sampler = samplers[packet.size] = Sampler{sampler_type, {x, y}, sample_index, seed};
+                            vec2 jitter = sampler.Get2D();
+                            float u = (x + jitter.x) / texture_size.x;
+                            float v = (y + jitter.y) / texture_size.y;
+                            packet.Add(camera.get_ray(u, v), infinity);
+                        }
+                    }
+                    packet.Finish();
+                    world.Hit(packet, 0.001f, recs.data(), hits, counter.intersection_tests);
+
+                    for (int y = by, i = 0; y < block_max.y; y++) {
+                        for (int x = bx; x < block_max.x; x++, i++) {
+                            PathFeatures features;
+                            Color color = RayColor(packet.rays[i], hits[i] ? &recs[i] : nullptr, samplers[i], counter, features);
+                            sink(x, y, color, features);
+                        }
+                    }
+                }
+            }
+        } else {
+            for (int y = tile_min.y; y < tile_max.y; y++) {
+                for (int x = tile_min.x; x < tile_max.x; x++) {
+                    Sampler sampler{sampler_type, {x, y}, sample_index, seed};
+                    vec2 jitter = sampler.Get2D();
+                    float u = (x + jitter.x) / texture_size.x;
+                    float v = (y + jitter.y) / texture_size.y;
+                    PathFeatures features;
+                    Color color = RayColor(camera.get_ray(u, v), sampler, counter, features);
+                    sink(x, y, color, features);
+                }
+            }
+        }
+    }
+
+    // Sums samples [first_sample, first_sample + sample_count) of every pixel in the region into sums,
+    // row major. Regions rendered elsewhere merge by adding sums and sample counts.
+    void RenderRegion(ivec2 region_min, ivec2 region_max, uint32_t first_sample, uint32_t sample_count, std::vector<Color>& sums) {
+        const ivec2 extent = region_max - region_min;
+        sums.assign(size_t(extent.x) * extent.y, Color{0.0f});
+
+        const ivec2 grid{(extent.x + tile_size - 1) / tile_size, (extent.y + tile_size - 1) / tile_size};
+        counters.assign(pool.size(), PathCounters{});
+        if (integrator == Integrator::Wavefront) {
+            wavefronts.resize(pool.size());
+        }
+
+        profiler.Reserve(pool.size());
+        const uint64_t frame_start = profiler.Now();
+
+        pool.ParallelFor(grid.x * grid.y, [&](uint32_t tile, unsigned worker) {
+            const uint64_t tile_start = profiler.Now();
+            const ivec2 tile_min = region_min + ivec2{int(tile % grid.x), int(tile / grid.x)} * tile_size;
+            const ivec2 tile_max = min(tile_min + tile_size, region_max);
+            PathCounters counter;
+
+            for (uint32_t sample = first_sample; sample < first_sample + sample_count; sample++) {
+                TraceTile(tile_min, tile_max, sample, worker, counter, [&](int x, int y, const Color& color, const PathFeatures&) {
+                    sums[size_t(y - region_min.y) * extent.x + x - region_min.x] += color;
+                });
+            }
+
+            const uint64_t tile_end = profiler.Now();
+            counter.busy_ns = tile_end - tile_start;
+            counters[worker] += counter;
+            profiler.Record(worker, "tile", tile_start, tile_end, tile);
+        });
+
+        FinishFrame("RenderRegion", frame_start);
+    }
+
+    // One sample in the middle of every preview_scale sized block, Tonemap scales it up
+    void RenderPreview() {
+        const int scale = preview_scale;
+        preview_size = {(texture_size.x + scale - 1) / scale, (texture_size.y + scale - 1) / scale};
+        preview.resize(preview_size.x * preview_size.y);
+
+        counters.assign(pool.size(), PathCounters{});
+        profiler.Reserve(pool.size());
+        const uint64_t frame_start = profiler.Now();
+
+        pool.ParallelFor(preview_size.y, [&](uint32_t row, unsigned worker) {
+            const uint64_t row_start = profiler.Now();
+            const int y = std::min(int(row) * scale + scale / 2, texture_size.y - 1);
+            PathCounters counter;
+
+            // Same kernels as TraceTile, a row is the unit of work here
+            cpu::dispatch([&] {
+                for (int px = 0; px < preview_size.x; px++) {
+                    const int x = std::min(px * scale + scale / 2, texture_size.x - 1);
+                    Sampler sampler{sampler_type, {x, y}, 0, seed};
+                    PathFeatures features;
+                    const Ray ray = camera.get_ray((x + 0.5f) / texture_size.x, (y + 0.5f) / texture_size.y);
+                    preview[row * preview_size.x + px] = RayColor(ray, sampler, counter, features);
+                }
+            });
+
+            const uint64_t row_end = profiler.Now();
+            counter.busy_ns = row_end - row_start;
+            counters[worker] += counter;
+            profiler.Record(worker, "preview row", row_start, row_end, row);
+        });
+
+        FinishFrame("RenderPreview", frame_start);
+
+        // Steer the next preview towards the budget
+        const float ms = frame_ns * 1e-6f;
+        if (ms > interactive.preview_budget_ms * 1.2f) {
+            preview_scale = std::min(preview_scale + 1, interactive.max_preview_scale);
+        } else if (ms < interactive.preview_budget_ms * 0.4f) {
+            preview_scale = std::max(preview_scale - 1, 1);
+        }
+    }
+
+    void FinishFrame(const char* name, uint64_t frame_start) {
+        const uint64_t frame_end = profiler.Now();
+        frame_ns = frame_end - frame_start;
+
+        const PathCounters frame = FrameCounters();
+        total += frame;
+        profiler.RecordMain(name, frame_start, frame_end, frame.rays + frame.shadow_rays);
+    }
+
+    uint32_t PixelSamples(size_t i) const {
+        if (tile_samples.empty() || grid_tile_size == 0) {
+            return 0;
+        }
+        const int x = i % texture_size.x;
+        const int y = i / texture_size.x;
+        return tile_samples[(y / grid_tile_size) * tile_grid.x + x / grid_tile_size];
+    }
+
+    // Accumulated samples blended with the reprojected history, returns how many samples the result is worth
+    float Resolve(size_t i, Color& color, float& distance) const {
+        const float n = PixelSamples(i);
+        const float h = history.empty() ? 0.0f : history.weight[i];
+        if (h <= 0.0f) {
+            color = pixels[i];
+            distance = pixel_depth[i];
+            return n;
+        }
+
+        color = (pixels[i] * n + history.color[i] * h) / (n + h);
+        distance = n > 0.0f ? pixel_depth[i] : history.depth[i];
+        return n + h;
+    }
+
+    // Filters the resolved image into denoised, which the display shows while denoising is enabled
+    void Denoise() {
+        const uint64_t start = profiler.Now();
+        denoiser.Resize(texture_size);
+        pool.ParallelFor(texture_size.y, [&](uint32_t y, unsigned) {
+            for (int x = 0; x < texture_size.x; x++) {
+                const size_t i = y * texture_size.x + x;
+                Color color;
+                float distance;
+                const float weight = Resolve(i, color, distance);
+                denoiser.Set(x, y, color, LuminanceVariance(i, weight), feature_albedo[i], feature_normal[i], distance);
+            }
+        });
+
+        denoiser.Filter(pool, denoise);
+
+        denoised.resize(pixels.size());
+        pool.ParallelFor(texture_size.y, [&](uint32_t y, unsigned) {
+            for (int x = 0; x < texture_size.x; x++) {
+                denoised[y * texture_size.x + x] = denoiser.Get(x, y);
+            }
+        });
+        profiler.RecordMain("denoise", start, profiler.Now());
+    }
+
+    // Variance of a pixel's mean luminance when the mean is worth weight samples
+    float LuminanceVariance(size_t i, float weight) const {
+        const uint32_t n = PixelSamples(i);
+        if (n < 2) {
+            return 1.0f;
+        }
+        return variance[i].m2 / (n - 1) / weight;
+    }
+
+    // Scenes can be replaced or grown wholesale before rendering, the staging copy follows them
+    void SyncStaging() {
+        if (staged_shapes.size() != world.ObjectCount()) {
+            staged_shapes.resize(world.ObjectCount());
+            for (uint32_t object = 0; object < staged_shapes.size(); object++) {
+                staged_shapes[object] = world.VisitShape(object, [](const auto& shape) { return typename World::Shape{shape}; });
+            }
+            edited_objects.clear();
+        }
+    }
+
+    // Folds the n-th sample of a pixel into its mean and variance, returns the pixel's relative error
+    float Accumulate(int x, int y, const Color& color, const PathFeatures& features, uint32_t n) {
+        const size_t i = y * texture_size.x + x;
+        pixel_depth[i] = features.distance;
+        const float weight = 1.0f / n;
+        if (denoise.enabled) {
+            feature_albedo[i] = n == 1 ? features.albedo : feature_albedo[i] * (1.0f - weight) + weight * features.albedo;
+            feature_normal[i] = n == 1 ? features.normal : feature_normal[i] * (1.0f - weight) + weight * features.normal;
+        }
+        // The display clamps at 1, so differences above it are not worth samples
+        const float sample_luminance = std::min(luminance(color), 1.0f);
+        LuminanceMoments& moments = variance[i];
+        if (n == 1) {
+            moments = LuminanceMoments{};
+        }
+
+        pixels[i] = n == 1 ? color : pixels[i] * (1.0f - weight) + weight * color;
+
+        const float delta = sample_luminance - moments.mean;
+        moments.mean += delta * weight;
+        moments.m2 += delta * (sample_luminance - moments.mean);
+
+        if (n < 2) {
+            return infinity;
+        }
+        const float standard_error = std::sqrt(moments.m2 / (float(n - 1) * n));
+        return standard_error / (std::max(moments.mean, 0.0f) + adaptive.luminance_offset);
+    }
+
+    // Gamma corrected copy of the accumulation buffer for display and 8-bit output
+    void Tonemap(std::vector<Color>& out) {
+        out.resize(pixels.size());
+        pool.ParallelFor(texture_size.y, [&](uint32_t y, unsigned) {
+            for (int x = 0; x < texture_size.x; x++) {
+                out[y * texture_size.x + x] = DisplayColor(x, y);
+            }
+        });
+    }
+
+    // Same, packed for a GL_RGBA8 texture
+    void Tonemap(std::vector<Rgba8>& out) {
+        out.resize(pixels.size());
+        pool.ParallelFor(texture_size.y, [&](uint32_t y, unsigned) {
+            for (int x = 0; x < texture_size.x; x++) {
+                const Color color = DisplayColor(x, y) * 255.0f + 0.5f;
+                out[y * texture_size.x + x] = Rgba8{uint8_t(color.r), uint8_t(color.g), uint8_t(color.b), 255};
+            }
+        });
+    }
+
+    Color DisplayColor(int x, int y) const {
+        Color color;
+        if (moving) {
+            color = preview[(y / preview_scale) * preview_size.x + x / preview_scale];
+        } else if (denoise.enabled && denoised.size() == pixels.size()) {
+            color = denoised[y * texture_size.x + x];
+        } else {
+            float distance;
+            Resolve(y * texture_size.x + x, color, distance);
+        }
+        return gamma_encode(color);
+    }
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock free handoff of whole frames from one producer to one consumer. The producer fills Back()
+// and publishes it, the consumer picks up the newest published slot. Neither side ever waits for
+// the other, a frame the consumer did not get to in time is simply replaced by the next one.
+template <typename T>
+struct TripleBuffer {
+    T slots[3];
+
+    // Producer side
+    T& Back() {
+        return slots[back];
+    }
+
+    void Publish() {
+        back = middle.exchange(back | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Consumer side, returns false while nothing newer than Front() was published
+    bool Acquire() {
+        if (!(middle.load(std::memory_order_acquire) & fresh)) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    const T& Front() const {
+        return slots[front];
+    }
+
+  private:
+    static constexpr uint32_t index_mask = 3;
+    static constexpr uint32_t fresh = 4;
+
+    // The slot between the two sides, fresh is set while it holds a frame the consumer has not seen
+    std::atomic<uint32_t> middle{1};
+    uint32_t back = 0;
+    uint32_t front = 2;
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "camera.hpp"
+#include "hit_record.hpp"
+#include "integrator.hpp"
+#include "packet.hpp"
+#include "sampler.hpp"
+
+enum class Integrator {
+    Recursive,
+    Wavefront,
+};
+
+// Breadth first integrator, a whole tile of paths advances one bounce at a time:
+// generate camera rays, intersect all live paths, bin the hits by material type,
+// shade every bin with its own material kernel, trace the batch of shadow rays
+// and compact the surviving paths.
+// Computes the same estimate as Tracer::RayColor, one buffer set per worker.
+template <typename World>
+struct Wavefront {
+    struct Path {
+        PathState state;
+        Sampler sampler;
+    };
+
+    std::vector<Path> paths;
+    std::vector<hit_record> hits;
+    std::vector<ShadowRay> shadows;
+    std::vector<uint32_t> shadow_paths;
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> next_active;
+    std::array<std::vector<uint32_t>, World::material_type_count> queues;
+
+    // One path per pixel of the tile, row major, Radiance(i) belongs to the i-th pixel
+    void Generate(const Camera& camera, ivec2 texture_size, ivec2 tile_min, ivec2 tile_max, SamplerType sampler_type, uint32_t sample_index, uint32_t seed) {
+        paths.clear();
+        active.clear();
+
+        for (int y = tile_min.y; y < tile_max.y; y++) {
+            for (int x = tile_min.x; x < tile_max.x; x++) {
+                Sampler sampler{sampler_type, {x, y}, sample_index, seed};
+                vec2 jitter = sampler.Get2D();
+                float u = (x + jitter.x) / texture_size.x;
+                float v = (y + jitter.y) / texture_size.y;
+
+                active.push_back(paths.size());
+                paths.push_back(Path{PathState{}, sampler});
+                paths.back().state.ray = camera.get_ray(u, v);
+            }
+        }
+
+        hits.resize(paths.size());
+    }
+
+    const Color& Radiance(size_t i) const {
+        return paths[i].state.radiance;
+    }
+
+    const PathFeatures& Features(size_t i) const {
+        return paths[i].state.features;
+    }
+
+    // Runs every path to termination
+    void Trace(const World& world, const PathSettings& settings, PathCounters& counters) {
+        for (int depth = 0; depth < settings.max_depth && !active.empty(); depth++) {
+            // Intersect, paths that escape the scene pick up the environment and end
+            for (auto& queue : queues) {
+                queue.clear();
+            }
+
+            if (depth == 0 && settings.packets) {
+                IntersectPackets(world, settings, counters);
+            } else {
+                for (uint32_t path : active) {
+                    counters.CountRay(depth);
+                    if (world.Hit(paths[path].state.ray, 0.001, infinity, hits[path], counters.intersection_tests)) {
+                        Bin(path, counters);
+                    } else {
+                        ShadeMiss(world, settings, paths[path].state);
+                    }
+                }
+            }
+
+            // Shade each material bin with its own kernel
+            next_active.clear();
+            shadows.clear();
+            shadow_paths.clear();
+            [&]<size_t... I>(std::index_sequence<I...>) {
+                (Shade<I>(world, depth, settings, counters), ...);
+            }(std::make_index_sequence<World::material_type_count>{});
+
+            // Visibility of the next-event samples
+            for (size_t i = 0; i < shadows.size(); i++) {
+                if (!world.Occluded(shadows[i].ray, 0.001, shadows[i].t_max, counters.intersection_tests)) {
+                    paths[shadow_paths[i]].state.radiance += shadows[i].contribution;
+                }
+            }
+
+            std::swap(active, next_active);
+        }
+    }
+
+  private:
+    RayPacket packet;
+
+    void Bin(uint32_t path, PathCounters& counters) {
+        const size_t material_type = hits[path].mat_type;
+        counters.material_hits[material_type]++;
+        queues[material_type].push_back(path);
+    }
+
+    // Camera rays come in tile order, every run of 64 of them covers a few neighboring rows
+    void IntersectPackets(const World& world, const PathSettings& settings, PathCounters& counters) {
+        bool hit[RayPacket::max_size];
+        hit_record recs[RayPacket::max_size];
+        for (size_t first = 0; first < active.size(); first += RayPacket::max_size) {
+            const size_t count = std::min<size_t>(RayPacket::max_size, active.size() - first);
+            packet.Clear();
+            for (size_t i = 0; i < count; i++) {
+                packet.Add(paths[active[first + i]].state.ray, infinity);
+            }
+            packet.Finish();
+
+            // Records come back in packet order, hits is indexed by path
+            world.Hit(packet, 0.001f, recs, hit, counters.intersection_tests);
+            for (size_t i = 0; i < count; i++) {
+                counters.CountRay(0);
+                if (hit[i]) {
+                    hits[active[first + i]] = recs[i];
+                    Bin(active[first + i], counters);
+                } else {
+                    ShadeMiss(world, settings, paths[active[first + i]].state);
+                }
+            }
+        }
+    }
+
+    template <size_t MaterialType>
+    void Shade(const World& world, int depth, const PathSettings& settings, PathCounters& counters) {
+        for (uint32_t path_idx : queues[MaterialType]) {
+            Path& path = paths[path_idx];
+            const hit_record& rec = hits[path_idx];
+            const auto& mat = std::get<MaterialType>(world.materials)[rec.mat_index];
+
+            ShadowRay shadow;
+            bool has_shadow;
+            if (ShadeHit(world, mat, rec, depth, settings, path.state, path.sampler, shadow, has_shadow, counters)) {
+                next_active.push_back(path_idx);
+            }
+
+            if (has_shadow) {
+                shadows.push_back(shadow);
+                shadow_paths.push_back(path_idx);
+            }
+        }
+    }
+};
@@ -0,0 +1,579 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sampling.hpp"
+#include "scenes.hpp"
+#include "simd.hpp"
+#include "tracer.hpp"
+
+// Fixed workloads for the tracing hot paths. Every ray set and scene is generated from a constant
+// seed, so two runs of the same build trace exactly the same rays and results can be compared
+// across commits, either by diffing the --json output or by passing an older file as --baseline.
+
+struct Options {
+    std::string filter;
+    std::string json;
+    std::string baseline;
+    double min_time = 0.25;
+    unsigned max_threads = std::thread::hardware_concurrency();
+    int width = 320;
+    int height = 180;
+    int spp = 2;
+    std::string isa;
+};
+
+struct Result {
+    std::string name;
+    uint64_t items = 0;
+    double seconds = 0.0;
+    unsigned threads = 1;
+    double speedup = 1.0;
+
+    double ns_per_item() const {
+        return seconds * 1e9 / items;
+    }
+
+    double mrays_per_second() const {
+        return items / seconds * 1e-6;
+    }
+};
+
+using World = Tracer::World;
+
+constexpr uint32_t ray_count = 1 << 16;
+
+// Keeps the optimizer from dropping results nobody reads
+static volatile float sink;
+
+static float Random(std::mt19937& rng) {
+    return to_unit_float(rng());
+}
+
+static vec3 RandomDirection(std::mt19937& rng) {
+    float z = 1.0f - 2.0f * Random(rng);
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    float phi = 2.0f * float(pi) * Random(rng);
+    return vec3{r * std::cos(phi), r * std::sin(phi), z};
+}
+
+// Rays from a sphere around the target aimed into a box 1.5 times its size, so roughly half of them hit
+static std::vector<Ray> RaysAt(const AABB& target, uint32_t seed) {
+    std::mt19937 rng{seed};
+    const vec3 center = target.centroid();
+    const vec3 extent = target.max - target.min;
+    const float radius = 1.5f * length(extent) + 1.0f;
+
+    std::vector<Ray> rays;
+    rays.reserve(ray_count);
+    for (uint32_t i = 0; i < ray_count; i++) {
+        vec3 origin = center + radius * RandomDirection(rng);
+        vec3 aim = center + 1.5f * extent * (vec3{Random(rng), Random(rng), Random(rng)} - 0.5f);
+        rays.emplace_back(origin, aim - origin);
+    }
+    return rays;
+}
+
+// Primary rays through random pixel positions
+static std::vector<Ray> CameraRays(const Camera& camera, uint32_t seed) {
+    std::mt19937 rng{seed};
+    std::vector<Ray> rays;
+    rays.reserve(ray_count);
+    for (uint32_t i = 0; i < ray_count; i++) {
+        float u = Random(rng);
+        rays.push_back(camera.get_ray(u, Random(rng)));
+    }
+    return rays;
+}
+
+// Rays with random origins inside the scene and random directions, like deep path segments
+static std::vector<Ray> IncoherentRays(const AABB& bounds, uint32_t seed) {
+    std::mt19937 rng{seed};
+    std::vector<Ray> rays;
+    rays.reserve(ray_count);
+    for (uint32_t i = 0; i < ray_count; i++) {
+        vec3 origin = bounds.min + (bounds.max - bounds.min) * vec3{Random(rng), Random(rng), Random(rng)};
+        rays.emplace_back(origin, RandomDirection(rng));
+    }
+    return rays;
+}
+
+static std::shared_ptr<MeshData> SphereMesh(int rings, int segments, float radius) {
+    auto mesh = std::make_shared<MeshData>();
+    std::vector<vec3> positions;
+    std::vector<uint32_t> indices;
+
+    for (int ring = 0; ring <= rings; ring++) {
+        float theta = float(pi) * ring / rings;
+        for (int segment = 0; segment <= segments; segment++) {
+            float phi = 2.0f * float(pi) * segment / segments;
+            positions.push_back(radius * vec3{std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)});
+        }
+    }
+
+    for (int ring = 0; ring < rings; ring++) {
+        for (int segment = 0; segment < segments; segment++) {
+            uint32_t a = ring * (segments + 1) + segment;
+            uint32_t b = a + segments + 1;
+            indices.insert(indices.end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+
+    mesh->positions = std::move(positions);
+    mesh->indices = std::move(indices);
+    mesh->Build();
+    return mesh;
+}
+
+// A ground plane, one big light and count spheres on a grid with seeded sizes and materials
+static void SphereField(World& world, Camera& camera, int count, uint32_t seed) {
+    std::mt19937 rng{seed};
+    const int side = int(std::ceil(std::sqrt(float(count))));
+    const float spacing = 1.2f;
+    const float half = side * spacing * 0.5f;
+
+    world.add(Sphere(vec3{0.0f, -1000.0f, 0.0f}, 1000.0f), Lambertian(Color{0.5f}));
+    world.add(Sphere(vec3{0.0f, half + 20.0f, 0.0f}, half * 0.5f + 5.0f), DiffuseLight(Color{4.0f}));
+
+    for (int i = 0; i < count; i++) {
+        float radius = 0.2f + 0.3f * Random(rng);
+        vec3 center{(i % side) * spacing - half, radius, (i / side) * spacing - half};
+        float pick = Random(rng);
+        Color color{Random(rng), Random(rng), Random(rng)};
+
+        if (pick < 0.6f) {
+            world.add(Sphere(center, radius), Lambertian(color));
+        } else if (pick < 0.85f) {
+            world.add(Sphere(center, radius), Metal(color));
+        } else {
+            world.add(Sphere(center, radius), Dielectric(1.5f));
+        }
+    }
+
+    world.Build();
+    camera.look_from = vec3{0.0f, half * 0.6f + 2.0f, half + 4.0f};
+    camera.look_at = vec3{0.0f, 0.0f, 0.0f};
+    camera.vfov = 60.0f;
+    camera.UpdateVectors();
+}
+
+struct CannedScene {
+    std::string name;
+    std::function<void(World&, Camera&)> setup;
+};
+
+static std::vector<CannedScene> CannedScenes() {
+    return {
+        {"default", [](World& world, Camera&) { DefaultScene(world); }},
+        {"spheres_64", [](World& world, Camera& camera) { SphereField(world, camera, 64, 1); }},
+        {"spheres_1024", [](World& world, Camera& camera) { SphereField(world, camera, 1024, 2); }},
+        {"spheres_16384", [](World& world, Camera& camera) { SphereField(world, camera, 16384, 3); }},
+        {"mesh_131k",
+         [](World& world, Camera& camera) {
+             SphereField(world, camera, 64, 4);
+             world.add(TriangleMesh(SphereMesh(256, 256, 3.0f), vec3{0.0f, 3.0f, 0.0f}), Lambertian(Color{0.7f}));
+             world.Build();
+         }},
+    };
+}
+
+struct Bench {
+    Options options;
+    std::vector<Result> results;
+    std::map<std::string, double> baseline;
+
+    bool Selected(const std::string& name) const {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    // Repeats run() until min_time has passed and keeps the fastest repetition, which is the least
+    // disturbed by other processes. run() returns the number of items it processed.
+    void Measure(const std::string& name, const std::function<uint64_t()>& run, unsigned threads = 1, double single_thread = 0.0) {
+        if (!Selected(name)) {
+            return;
+        }
+
+        run();
+
+        Result result{name, 0, infinity, threads};
+        double total = 0.0;
+        int repetitions = 0;
+        while (total < options.min_time || repetitions < 3) {
+            const auto start = std::chrono::steady_clock::now();
+            const uint64_t items = run();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (seconds / items < result.seconds / std::max<uint64_t>(result.items, 1)) {
+                result.items = items;
+                result.seconds = seconds;
+            }
+            total += seconds;
+            repetitions++;
+        }
+
+        if (single_thread > 0.0) {
+            result.speedup = single_thread / result.ns_per_item();
+        }
+
+        Report(result);
+        results.push_back(result);
+    }
+
+    // Measure with run compiled for the instruction set cpu::isa selects, like the tiles of a frame
+    template <typename Run>
+    void MeasureKernel(const std::string& name, Run&& run) {
+        Measure(name, [&] {
+            uint64_t items = 0;
+            cpu::dispatch([&] { items = run(); });
+            return items;
+        });
+    }
+
+    void Report(const Result& result) const {
+        std::printf("%-40s %10.2f %10.2f %8u %8.2f", result.name.c_str(), result.ns_per_item(), result.mrays_per_second(), result.threads,
+                    result.speedup);
+
+        auto old = baseline.find(result.name);
+        if (old != baseline.end()) {
+            std::printf(" %+8.1f%%", (result.ns_per_item() / old->second - 1.0) * 100.0);
+        }
+        std::printf("\n");
+    }
+
+    template <typename Shape>
+    void PrimitiveHit(const std::string& name, const Shape& shape) {
+        const std::vector<Ray> rays = RaysAt(shape.Bounds(), 7);
+        MeasureKernel("hit/" + name, [&] {
+            hit_record rec;
+            float sum = 0.0f;
+            for (const Ray& ray : rays) {
+                if (shape.Hit(ray, 0.001f, infinity, rec)) {
+                    sum += rec.t;
+                }
+            }
+            sink = sum;
+            return uint64_t(rays.size());
+        });
+    }
+
+    template <typename Material>
+    void Scatter(const std::string& name, const Material& material) {
+        std::mt19937 rng{11};
+        std::vector<std::pair<Ray, hit_record>> cases(ray_count);
+        for (auto& [ray, rec] : cases) {
+            vec3 normal = RandomDirection(rng);
+            vec3 origin = 3.0f * RandomDirection(rng);
+            rec.point = normal;
+            ray = Ray(origin, rec.point - origin);
+            rec.set_face_normal(ray, normal);
+        }
+
+        MeasureKernel("scatter/" + name, [&] {
+            float sum = 0.0f;
+            uint32_t index = 0;
+            for (const auto& [ray, rec] : cases) {
+                Sampler sampler{SamplerType::Random, {int(index), 0}, 0, 5};
+                Color attenuation;
+                Ray scattered;
+                if (material.scatter(ray, rec, attenuation, scattered, sampler)) {
+                    sum += scattered.direction.x + attenuation.r;
+                }
+                index++;
+            }
+            sink = sum;
+            return uint64_t(cases.size());
+        });
+    }
+
+    // Unit sphere directions through libm, the scalar polynomial kernels and the batched ones
+    void Sampling() {
+        std::mt19937 rng{13};
+        aligned_vector<float> u1(ray_count), u2(ray_count), x(ray_count), y(ray_count), z(ray_count);
+        for (uint32_t i = 0; i < ray_count; i++) {
+            u1[i] = Random(rng);
+            u2[i] = Random(rng);
+        }
+
+        auto checksum = [&] {
+            float sum = 0.0f;
+            for (uint32_t i = 0; i < ray_count; i += 97) {
+                sum += x[i] + y[i] + z[i];
+            }
+            sink = sum;
+            return uint64_t(ray_count);
+        };
+
+        MeasureKernel("sampling/sphere_libm", [&] {
+            for (uint32_t i = 0; i < ray_count; i++) {
+                const float theta = u1[i] * (2.0f * float(pi));
+                const float phi = std::acos(u2[i] * 2.0f - 1.0f);
+                x[i] = std::sin(phi) * std::cos(theta);
+                y[i] = std::sin(phi) * std::sin(theta);
+                z[i] = std::cos(phi);
+            }
+            return checksum();
+        });
+        MeasureKernel("sampling/sphere_scalar", [&] {
+            for (uint32_t i = 0; i < ray_count; i++) {
+                const vec3 p = uniform_sphere(vec2{u1[i], u2[i]});
+                x[i] = p.x;
+                y[i] = p.y;
+                z[i] = p.z;
+            }
+            return checksum();
+        });
+        MeasureKernel("sampling/sphere_batch", [&] {
+            uniform_sphere_batch(u1.data(), u2.data(), x.data(), y.data(), z.data(), ray_count);
+            return checksum();
+        });
+        MeasureKernel("sampling/schlick_batch", [&] {
+            schlick_batch(u1.data(), 0.04f, x.data(), ray_count);
+            return checksum();
+        });
+    }
+
+    void SceneQueries(const CannedScene& canned) {
+        const std::string primary_name = "scene_hit/" + canned.name + "/primary";
+        const std::string incoherent_name = "scene_hit/" + canned.name + "/incoherent";
+        const std::string occluded_name = "scene_occluded/" + canned.name + "/incoherent";
+        if (!Selected(primary_name) && !Selected(incoherent_name) && !Selected(occluded_name)) {
+            return;
+        }
+
+        World world;
+        Camera camera{float(options.width) / options.height};
+        canned.setup(world, camera);
+
+        AABB bounds;
+        for (const AABB& object : world.object_bounds) {
+            bounds.grow(object);
+        }
+        // The ground sphere would make the incoherent origins mostly empty space
+        bounds = AABB{glm::max(bounds.min, vec3{-50.0f}), glm::min(bounds.max, vec3{50.0f})};
+
+        const std::vector<Ray> primary = CameraRays(camera, 21);
+        const std::vector<Ray> incoherent = IncoherentRays(bounds, 22);
+
+        auto hit = [&](const std::vector<Ray>& rays) {
+            hit_record rec;
+            float sum = 0.0f;
+            for (const Ray& ray : rays) {
+                if (world.Hit(ray, 0.001f, infinity, rec)) {
+                    sum += rec.t;
+                }
+            }
+            sink = sum;
+            return uint64_t(rays.size());
+        };
+
+        MeasureKernel(primary_name, [&] { return hit(primary); });
+        MeasureKernel(incoherent_name, [&] { return hit(incoherent); });
+        MeasureKernel(occluded_name, [&] {
+            uint32_t count = 0;
+            for (const Ray& ray : incoherent) {
+                count += world.Occluded(ray, 0.001f, 10.0f);
+            }
+            sink = float(count);
+            return uint64_t(incoherent.size());
+        });
+    }
+
+    // Whole frames through MakePixels at 1, 2, 4, ... threads up to max_threads
+    void Frames(const CannedScene& canned, Integrator integrator) {
+        const std::string prefix = std::string("frame/") + (integrator == Integrator::Wavefront ? "wavefront/" : "recursive/") + canned.name;
+
+        std::vector<unsigned> thread_counts;
+        for (unsigned threads = 1; threads < options.max_threads; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(options.max_threads);
+
+        // Speedups are relative to the one thread run and stay at 1 when the filter excludes it
+        bool selected = false;
+        for (unsigned threads : thread_counts) {
+            selected |= Selected(prefix + "/t" + std::to_string(threads));
+        }
+        if (!selected) {
+            return;
+        }
+
+        Tracer tracer{float(options.width) / options.height, 1};
+        canned.setup(tracer.world, tracer.camera);
+        tracer.integrator = integrator;
+
+        double single_thread = 0.0;
+        for (unsigned threads : thread_counts) {
+            tracer.pool.Resize(threads);
+            const std::string name = prefix + "/t" + std::to_string(threads);
+            Measure(
+                name,
+                [&] {
+                    tracer.Resize(options.width, options.height);
+                    tracer.total = PathCounters{};
+                    for (int i = 0; i < options.spp; i++) {
+                        tracer.MakePixels();
+                    }
+                    const PathCounters counters = tracer.Counters();
+                    return counters.rays + counters.shadow_rays;
+                },
+                threads, single_thread);
+
+            if (threads == 1 && !results.empty() && results.back().name == name) {
+                single_thread = results.back().ns_per_item();
+            }
+        }
+    }
+
+    bool ReadBaseline(const std::string& path) {
+        std::ifstream file{path};
+        if (!file) {
+            return false;
+        }
+
+        // WriteJSON puts every result on its own line
+        std::string line;
+        while (std::getline(file, line)) {
+            size_t name = line.find("\"name\": \"");
+            size_t ns = line.find("\"ns_per_item\": ");
+            if (name == std::string::npos || ns == std::string::npos) {
+                continue;
+            }
+            name += 9;
+            baseline[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + ns + 15);
+        }
+        return true;
+    }
+
+    bool WriteJSON(const std::string& path) const {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) {
+            return false;
+        }
+
+        std::fprintf(file, "{\n  \"hardware_threads\": %u,\n  \"simd_width\": %d,\n  \"isa\": \"%s\",\n", std::thread::hardware_concurrency(), active_simd_width(),
+                     cpu::isa_name(cpu::isa));
+        std::fprintf(file, "  \"frame\": {\"width\": %d, \"height\": %d, \"spp\": %d},\n", options.width, options.height, options.spp);
+        std::fprintf(file, "  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            std::fprintf(file,
+                         "    {\"name\": \"%s\", \"items\": %llu, \"seconds\": %.9f, \"ns_per_item\": %.4f, \"mrays_per_s\": %.4f, "
+                         "\"threads\": %u, \"speedup\": %.4f}%s\n",
+                         r.name.c_str(), (unsigned long long)r.items, r.seconds, r.ns_per_item(), r.mrays_per_second(), r.threads, r.speedup,
+                         i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(file, "  ]\n}\n");
+        return std::fclose(file) == 0;
+    }
+};
+
+static void PrintUsage(const char* program) {
+    std::printf(
+        "usage: %s [options]\n"
+        "  --filter S      only run benchmarks whose name contains S\n"
+        "  --json P        write the results to P as JSON\n"
+        "  --baseline P    JSON from an earlier run to print the change in ns/item against\n"
+        "  --min-time S    seconds to spend on each benchmark (default 0.25)\n"
+        "  --threads N     highest thread count for the frame benchmarks (default hardware concurrency)\n"
+        "  --width N       frame width (default 320)\n"
+        "  --height N      frame height (default 180)\n"
+        "  --spp N         samples per pixel of one frame (default 2)\n"
+        "  --isa I         kernels to run: auto, baseline, avx2 or avx512 (default $RAYTRACER_ISA, else auto)\n",
+        program);
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0 || !value) {
+            return false;
+        }
+
+        if (std::strcmp(arg, "--filter") == 0) {
+            options.filter = value;
+        } else if (std::strcmp(arg, "--json") == 0) {
+            options.json = value;
+        } else if (std::strcmp(arg, "--baseline") == 0) {
+            options.baseline = value;
+        } else if (std::strcmp(arg, "--min-time") == 0) {
+            options.min_time = std::atof(value);
+        } else if (std::strcmp(arg, "--threads") == 0) {
+            options.max_threads = std::atoi(value);
+        } else if (std::strcmp(arg, "--width") == 0) {
+            options.width = std::atoi(value);
+        } else if (std::strcmp(arg, "--height") == 0) {
+            options.height = std::atoi(value);
+        } else if (std::strcmp(arg, "--spp") == 0) {
+            options.spp = std::atoi(value);
+        } else if (std::strcmp(arg, "--isa") == 0) {
+            options.isa = value;
+        } else {
+            return false;
+        }
+        i++;
+    }
+
+    return options.width > 0 && options.height > 0 && options.spp > 0 && options.max_threads > 0;
+}
+
+int main(int argc, char** argv) {
+    Bench bench;
+    if (!ParseOptions(argc, argv, bench.options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    if (!bench.options.baseline.empty() && !bench.ReadBaseline(bench.options.baseline)) {
+        std::fprintf(stderr, "cannot read %s\n", bench.options.baseline.c_str());
+        return 1;
+    }
+
+    std::string error;
+    if (!cpu::select_isa(bench.options.isa, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    std::printf("%s kernels, %d wide\n", cpu::isa_name(cpu::isa), active_simd_width());
+    std::printf("%-40s %10s %10s %8s %8s%s\n", "benchmark", "ns/item", "Mrays/s", "threads", "speedup", bench.baseline.empty() ? "" : "   change");
+
+    bench.PrimitiveHit("sphere", Sphere(vec3{0.0f}, 1.0f));
+    bench.PrimitiveHit("box", Box(vec3{-1.0f}, vec3{1.0f}));
+    bench.PrimitiveHit("mesh_8k", TriangleMesh(SphereMesh(64, 64, 1.0f)));
+
+    bench.Scatter("metal", Metal(Color{0.8f}));
+    bench.Scatter("lambertian", Lambertian(Color{0.8f}));
+    bench.Scatter("dielectric", Dielectric(1.5f));
+    bench.Sampling();
+
+    const std::vector<CannedScene> scenes = CannedScenes();
+    for (const CannedScene& scene : scenes) {
+        bench.SceneQueries(scene);
+    }
+
+    for (const CannedScene& scene : scenes) {
+        bench.Frames(scene, Integrator::Recursive);
+    }
+    for (const CannedScene& scene : scenes) {
+        bench.Frames(scene, Integrator::Wavefront);
+    }
+
+    if (!bench.options.json.empty()) {
+        if (!bench.WriteJSON(bench.options.json)) {
+            std::fprintf(stderr, "failed to write %s\n", bench.options.json.c_str());
+            return 1;
+        }
+        std::printf("wrote %s\n", bench.options.json.c_str());
+    }
+}
@@ -0,0 +1,32 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "scene_file.hpp"
+#include "tracer.hpp"
+
+// Converts a text scene into the binary form, which loads without parsing or BVH builds
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::printf("usage: %s input.scene output.bscene\n", argv[0]);
+        return 1;
+    }
+
+    Tracer::World world;
+    Camera camera{16.0f / 9.0f};
+    std::string error;
+
+    const auto start = std::chrono::steady_clock::now();
+    if (!LoadScene(argv[1], world, camera, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    std::printf("loaded %s: %zu objects in %.3f s\n", argv[1], world.ObjectCount(),
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    if (!WriteSceneBinary(argv[2], world, camera, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", argv[2]);
+}
@@ -1,6 +1,26 @@
 #include <renderer.hpp>
 
-int main() {
+int main(int argc, char** argv) {
+    std::string error;
+    if (!cpu::select_isa("", error)) {
+        std::fprintf(stderr, "RAYTRACER_ISA: %s\n", error.c_str());
+        return 1;
+    }
+
     Renderer app(1000, (16.0f / 9.0f));
+
+    // Scene files replace the built in scene, images light it as an environment, anything else is
+    // loaded as a mesh
+    for (int i = 1; i < argc; i++) {
+        std::string path = argv[i];
+        if (path.ends_with(".scene") || path.ends_with(".bscene")) {
+            app.scene_path = path;
+        } else if (path.ends_with(".hdr") || path.ends_with(".pfm")) {
+            app.environment_path = path;
+        } else {
+            app.mesh_paths.push_back(path);
+        }
+    }
+
     app.Run();
 }
@@ -0,0 +1,527 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "animation.hpp"
+#include "checkpoint.hpp"
+#include "distributed.hpp"
+#include "image_io.hpp"
+#include "scene_file.hpp"
+#include "scenes.hpp"
+#include "tracer.hpp"
+
+struct Options {
+    int width = 1000;
+    int height = 563;
+    int spp = 64;
+    int max_depth = 8;
+    int tile_size = 16;
+    unsigned workers = std::thread::hardware_concurrency();
+    std::string isa;
+    uint32_t seed = 0;
+    SamplerType sampler = SamplerType::Sobol;
+    Integrator integrator = Integrator::Recursive;
+    bool next_event = true;
+    bool russian_roulette = true;
+    bool packets = true;
+    float adaptive = 0.0f;
+    int min_spp = 16;
+    bool denoise = false;
+    std::string reference;
+    std::string scene;
+    std::string trace;
+    std::string listen;
+    std::string connect;
+    int farm_tile = 64;
+    int farm_timeout = 300;
+    int farm_spp = 0;
+    std::string checkpoint;
+    float checkpoint_every = 60.0f;
+    std::string resume;
+    std::string cameras;
+    int turntable = 0;
+    int band = 0;
+    std::vector<std::string> meshes;
+    std::string environment;
+    float environment_intensity = 1.0f;
+    std::string output = "render";
+};
+
+static void PrintUsage(const char* program) {
+    std::printf(
+        "usage: %s [options]\n"
+        "  --width N       image width (default 1000)\n"
+        "  --height N      image height (default 563)\n"
+        "  --spp N         samples per pixel (default 64)\n"
+        "  --depth N       maximum path depth (default 8)\n"
+        "  --workers N     render threads (default hardware concurrency)\n"
+        "  --isa I         kernels to run: auto, baseline, avx2 or avx512 (default $RAYTRACER_ISA, else auto)\n"
+        "  --tile N        tile size in pixels (default 16)\n"
+        "  --sampler S     random or sobol (default sobol)\n"
+        "  --seed N        sampler seed (default 0)\n"
+        "  --integrator I  recursive or wavefront (default recursive)\n"
+        "  --nee 0|1       next-event estimation with MIS (default 1)\n"
+        "  --roulette 0|1  Russian roulette path termination (default 1)\n"
+        "  --packets 0|1   intersect camera rays in 8x8 packets (default 1)\n"
+        "  --adaptive T    stop sampling tiles whose relative error is below T, --spp becomes the maximum\n"
+        "  --min-spp N     samples every tile takes before adaptive sampling may stop it (default 16)\n"
+        "  --denoise 0|1   filter the result with the feature guided denoiser (default 0)\n"
+        "  --reference P   PFM image to report the RMSE against\n"
+        "  --trace P       write a Chrome trace (chrome://tracing, ui.perfetto.dev) of the render to P\n"
+        "  --scene P       load a text .scene or binary .bscene instead of the built in scene\n"
+        "  --mesh P        add an .obj or binary .ply mesh to the scene, can be repeated\n"
+        "  --environment P light the scene with the equirectangular .hdr or .pfm image P, replaces the scene's\n"
+        "  --environment-intensity S  scales the --environment image (default 1)\n"
+        "  --output P      output path without extension, writes P.pfm and P.ppm (default render)\n"
+        "  --listen A      coordinate a render over the workers that connect to A, host:port or unix:path\n"
+        "  --connect A     work for the coordinator at A, every other option but --workers and --isa comes from it\n"
+        "  --farm-tile N   tile size of the items handed to workers (default 64)\n"
+        "  --farm-spp N    samples per item, lets several workers share a tile (default all of --spp)\n"
+        "  --farm-timeout S  seconds a worker may stall a send or result before its items go to others (default 300)\n"
+        "  --checkpoint P  save the accumulation state to P periodically and at the end\n"
+        "  --checkpoint-every S  seconds between checkpoints (default 60)\n"
+        "  --resume P      continue the render saved in checkpoint P up to --spp, checkpointing to P unless\n"
+        "                  --checkpoint says otherwise; the checkpoint's image settings replace the options\n"
+        "  --cameras P     render one frame per pose of the keyframe file P, to <output>_0000.ppm/.pfm and on\n"
+        "  --turntable N   render N frames circling the scene camera around its look at point, like --cameras\n"
+        "  --band N        render N rows at a time and stream them to P.hdr and P.ppm, memory stays bounded\n"
+        "                  for any --width and --height\n",
+        program);
+}
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0 || !value) {
+            return false;
+        }
+
+        if (std::strcmp(arg, "--width") == 0) {
+            options.width = std::atoi(value);
+        } else if (std::strcmp(arg, "--height") == 0) {
+            options.height = std::atoi(value);
+        } else if (std::strcmp(arg, "--spp") == 0) {
+            options.spp = std::atoi(value);
+        } else if (std::strcmp(arg, "--depth") == 0) {
+            options.max_depth = std::atoi(value);
+        } else if (std::strcmp(arg, "--workers") == 0) {
+            options.workers = std::atoi(value);
+        } else if (std::strcmp(arg, "--isa") == 0) {
+            options.isa = value;
+        } else if (std::strcmp(arg, "--tile") == 0) {
+            options.tile_size = std::atoi(value);
+        } else if (std::strcmp(arg, "--sampler") == 0) {
+            if (std::strcmp(value, "random") == 0) {
+                options.sampler = SamplerType::Random;
+            } else if (std::strcmp(value, "sobol") == 0) {
+                options.sampler = SamplerType::Sobol;
+            } else {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--integrator") == 0) {
+            if (std::strcmp(value, "recursive") == 0) {
+                options.integrator = Integrator::Recursive;
+            } else if (std::strcmp(value, "wavefront") == 0) {
+                options.integrator = Integrator::Wavefront;
+            } else {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--seed") == 0) {
+            options.seed = std::strtoul(value, nullptr, 10);
+        } else if (std::strcmp(arg, "--nee") == 0) {
+            options.next_event = std::atoi(value) != 0;
+        } else if (std::strcmp(arg, "--roulette") == 0) {
+            options.russian_roulette = std::atoi(value) != 0;
+        } else if (std::strcmp(arg, "--packets") == 0) {
+            options.packets = std::atoi(value) != 0;
+        } else if (std::strcmp(arg, "--adaptive") == 0) {
+            options.adaptive = std::atof(value);
+        } else if (std::strcmp(arg, "--min-spp") == 0) {
+            options.min_spp = std::atoi(value);
+        } else if (std::strcmp(arg, "--denoise") == 0) {
+            options.denoise = std::atoi(value) != 0;
+        } else if (std::strcmp(arg, "--trace") == 0) {
+            options.trace = value;
+        } else if (std::strcmp(arg, "--scene") == 0) {
+            options.scene = value;
+        } else if (std::strcmp(arg, "--mesh") == 0) {
+            options.meshes.push_back(value);
+        } else if (std::strcmp(arg, "--environment") == 0) {
+            options.environment = value;
+        } else if (std::strcmp(arg, "--environment-intensity") == 0) {
+            options.environment_intensity = std::atof(value);
+        } else if (std::strcmp(arg, "--reference") == 0) {
+            options.reference = value;
+        } else if (std::strcmp(arg, "--listen") == 0) {
+            options.listen = value;
+        } else if (std::strcmp(arg, "--connect") == 0) {
+            options.connect = value;
+        } else if (std::strcmp(arg, "--farm-timeout") == 0) {
+            options.farm_timeout = std::atoi(value);
+        } else if (std::strcmp(arg, "--farm-tile") == 0) {
+            options.farm_tile = std::atoi(value);
+        } else if (std::strcmp(arg, "--farm-spp") == 0) {
+            options.farm_spp = std::atoi(value);
+        } else if (std::strcmp(arg, "--checkpoint") == 0) {
+            options.checkpoint = value;
+        } else if (std::strcmp(arg, "--checkpoint-every") == 0) {
+            options.checkpoint_every = std::atof(value);
+        } else if (std::strcmp(arg, "--resume") == 0) {
+            options.resume = value;
+        } else if (std::strcmp(arg, "--cameras") == 0) {
+            options.cameras = value;
+        } else if (std::strcmp(arg, "--turntable") == 0) {
+            options.turntable = std::atoi(value);
+        } else if (std::strcmp(arg, "--band") == 0) {
+            options.band = std::atoi(value);
+        } else if (std::strcmp(arg, "--output") == 0) {
+            options.output = value;
+        } else {
+            return false;
+        }
+        i++;
+    }
+
+    return options.width > 0 && options.height > 0 && options.spp > 0 && options.tile_size > 0 && options.farm_tile > 0 && options.farm_timeout > 0 && options.turntable >= 0 &&
+           options.band >= 0;
+}
+
+// Renders every pose of path with the one scene, BVH and thread pool. The writer encodes and
+// stores frame N while frame N + 1 traces.
+static int RenderBatch(const Options& options, Tracer& tracer, const CameraPath& path) {
+    const int frames = path.FrameCount();
+    // Every pose is a separate image, not a camera motion to preview and reproject
+    tracer.interactive.enabled = false;
+    FrameWriter writer{options.width, options.height, true};
+    char name[32];
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames && !writer.failed; frame++) {
+        const auto frame_start = std::chrono::steady_clock::now();
+        scene_file::FromRecord(path.At(frame), tracer.camera);
+        // The first sample of a new pose restarts the accumulation, a pose equal to the previous
+        // one keeps its finished image
+        if (tracer.last_camera && !tracer.last_camera->same_view(tracer.camera)) {
+            tracer.MakePixels();
+        }
+        while (tracer.samples < options.spp && !tracer.Converged()) {
+            tracer.MakePixels();
+        }
+        if (options.denoise) {
+            tracer.Denoise();
+        }
+
+        std::snprintf(name, sizeof(name), "_%04d", frame);
+        writer.Submit(options.output + name, options.denoise ? tracer.denoised : tracer.pixels);
+        std::printf("frame %d/%d: %.3f s\n", frame + 1, frames, std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count());
+    }
+    writer.Finish();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (writer.failed) {
+        std::fprintf(stderr, "%s\n", writer.error.c_str());
+        return 1;
+    }
+
+    const PathCounters counters = tracer.Counters();
+    const uint64_t rays = counters.rays + counters.shadow_rays;
+    std::printf("%d frames, %dx%d, %d spp, %u workers, %s kernels\n", frames, options.width, options.height, options.spp, tracer.pool.size(),
+                cpu::isa_name(cpu::isa));
+    std::printf("wall time: %.3f s, %.1f frames/hour\n", seconds, frames / seconds * 3600.0);
+    std::printf("rays: %llu (%.3f Mrays/s)\n", (unsigned long long)rays, rays / seconds * 1e-6);
+    std::printf("wrote %s_0000 to %s_%04d\n", options.output.c_str(), options.output.c_str(), frames - 1);
+    return 0;
+}
+
+// Renders the image band by band, every band takes all its samples at once and goes to the files
+// before the next one starts. Only one band of sums is ever in memory, the tracer's own full
+// image buffers stay empty.
+static int RenderBands(const Options& options, Tracer& tracer) {
+    tracer.texture_size = {options.width, options.height};
+
+    StreamedImage hdr, ppm;
+    const std::string hdr_path = options.output + ".hdr";
+    const std::string ppm_path = options.output + ".ppm";
+    if (!hdr.Open(hdr_path, StreamedImage::Format::HDR, options.width, options.height) ||
+        !ppm.Open(ppm_path, StreamedImage::Format::PPM, options.width, options.height)) {
+        std::fprintf(stderr, "cannot create %s / %s\n", hdr_path.c_str(), ppm_path.c_str());
+        return 1;
+    }
+
+    std::vector<Color> band;
+    std::vector<Color> tonemapped;
+    const auto start = std::chrono::steady_clock::now();
+    for (int y = 0; y < options.height; y += options.band) {
+        const int rows = std::min(options.band, options.height - y);
+        tracer.RenderRegion({0, y}, {options.width, y + rows}, 0, options.spp, band);
+
+        tonemapped.resize(band.size());
+        for (size_t i = 0; i < band.size(); i++) {
+            band[i] /= float(options.spp);
+            tonemapped[i] = gamma_encode(band[i]);
+        }
+        if (!hdr.WriteRows(y, rows, band) || !ppm.WriteRows(y, rows, tonemapped)) {
+            std::fprintf(stderr, "failed to write %s / %s\n", hdr_path.c_str(), ppm_path.c_str());
+            return 1;
+        }
+        std::printf("\rrows %d/%d", y + rows, options.height);
+        std::fflush(stdout);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!hdr.Close() || !ppm.Close()) {
+        std::fprintf(stderr, "failed to write %s / %s\n", hdr_path.c_str(), ppm_path.c_str());
+        return 1;
+    }
+
+    const PathCounters counters = tracer.Counters();
+    const uint64_t rays = counters.rays + counters.shadow_rays;
+    std::printf("\n%dx%d, %d spp, %u workers, %s kernels, bands of %d rows\n", options.width, options.height, options.spp, tracer.pool.size(),
+                cpu::isa_name(cpu::isa), options.band);
+    std::printf("wall time: %.3f s\n", seconds);
+    std::printf("rays: %llu (%.3f Mrays/s)\n", (unsigned long long)rays, rays / seconds * 1e-6);
+    std::printf("wrote %s and %s\n", hdr_path.c_str(), ppm_path.c_str());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::string isa_error;
+    if (!cpu::select_isa(options.isa, isa_error)) {
+        std::fprintf(stderr, "%s\n", isa_error.c_str());
+        return 1;
+    }
+
+    if (!options.connect.empty()) {
+        std::string error;
+        if (!RunWorker(options.connect, options.workers, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!options.listen.empty() && (options.adaptive > 0.0f || options.denoise)) {
+        std::fprintf(stderr, "--adaptive and --denoise need per pixel statistics that workers do not send back\n");
+        return 1;
+    }
+    if (!options.listen.empty() && (!options.checkpoint.empty() || !options.resume.empty())) {
+        std::fprintf(stderr, "checkpoints are not supported with --listen\n");
+        return 1;
+    }
+    const bool batch = !options.cameras.empty() || options.turntable > 0;
+    if (batch && (!options.listen.empty() || !options.checkpoint.empty() || !options.resume.empty() || !options.reference.empty() || !options.trace.empty())) {
+        std::fprintf(stderr, "--cameras and --turntable do not combine with --listen, checkpoints, --reference or --trace\n");
+        return 1;
+    }
+    if (options.band > 0 && (batch || !options.listen.empty() || !options.checkpoint.empty() || !options.resume.empty() || !options.reference.empty() ||
+                             !options.trace.empty() || options.adaptive > 0.0f || options.denoise)) {
+        std::fprintf(stderr, "--band renders one plain image, it does not combine with --adaptive, --denoise, batches, the farm, checkpoints,\n"
+                             "--reference or --trace\n");
+        return 1;
+    }
+    if (options.checkpoint.empty()) {
+        options.checkpoint = options.resume;
+    }
+
+    Tracer tracer{float(options.width) / options.height, options.workers};
+    tracer.settings.max_depth = options.max_depth;
+    tracer.settings.next_event = options.next_event;
+    tracer.settings.russian_roulette = options.russian_roulette;
+    tracer.settings.packets = options.packets;
+    tracer.tile_size = options.tile_size;
+    tracer.sampler_type = options.sampler;
+    tracer.seed = options.seed;
+    tracer.integrator = options.integrator;
+    tracer.adaptive.enabled = options.adaptive > 0.0f;
+    tracer.adaptive.threshold = options.adaptive;
+    tracer.adaptive.min_samples = options.min_spp;
+    tracer.denoise.enabled = options.denoise;
+    if (options.band == 0) {
+        tracer.Resize(options.width, options.height);
+    }
+
+    const auto load_start = std::chrono::steady_clock::now();
+    if (!options.scene.empty()) {
+        std::string error;
+        if (!LoadScene(options.scene, tracer.world, tracer.camera, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    } else {
+        DefaultScene(tracer.world);
+    }
+
+    if (!options.meshes.empty() && !AddMeshes(tracer.world, options.meshes)) {
+        return 1;
+    }
+
+    if (!options.environment.empty()) {
+        std::string error;
+        if (!tracer.world.environment.Load(options.environment, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        tracer.world.environment.intensity = options.environment_intensity;
+        tracer.world.environment.rotation = 0.0f;
+    }
+
+    if (!options.scene.empty() || !options.meshes.empty() || !options.environment.empty()) {
+        std::printf("scene setup: %.3f s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count());
+    }
+    tracer.camera.UpdateVectors();
+
+    if (options.band > 0) {
+        return RenderBands(options, tracer);
+    }
+
+    if (batch) {
+        CameraPath path;
+        std::string error;
+        if (!options.cameras.empty() && !path.Load(options.cameras, tracer.camera, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if (options.cameras.empty()) {
+            path = CameraPath::Turntable(tracer.camera, options.turntable);
+        }
+        return RenderBatch(options, tracer, path);
+    }
+
+    if (!options.resume.empty()) {
+        Checkpoint checkpoint;
+        std::string error;
+        if (!checkpoint.Read(options.resume, error) || !checkpoint.Restore(tracer, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        options.width = tracer.texture_size.x;
+        options.height = tracer.texture_size.y;
+        options.denoise = tracer.denoise.enabled;
+        std::printf("resumed %s at %d spp\n", options.resume.c_str(), tracer.samples);
+    }
+
+    CheckpointWriter checkpoints;
+    checkpoints.path = options.checkpoint;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+
+    if (!options.trace.empty()) {
+        tracer.profiler.Start(options.spp, tracer.pool.size());
+    }
+
+    Socket listener;
+    Coordinator coordinator;
+    if (!options.listen.empty()) {
+        std::string error;
+        listener = Socket::Listen(options.listen, error);
+        if (!listener.valid() || !coordinator.Prepare(tracer, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        coordinator.item_size = options.farm_tile;
+        coordinator.item_samples = options.farm_spp;
+        coordinator.worker_timeout = options.farm_timeout;
+        std::printf("waiting for workers on %s\n", options.listen.c_str());
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (listener.valid()) {
+        coordinator.Render(listener, tracer, options.spp);
+    } else {
+        while (tracer.samples < options.spp && !tracer.Converged()) {
+            tracer.MakePixels();
+            tracer.profiler.EndFrame();
+
+            const auto now = std::chrono::steady_clock::now();
+            if (!options.checkpoint.empty() && std::chrono::duration<float>(now - last_checkpoint).count() >= options.checkpoint_every) {
+                if (checkpoints.Start(tracer)) {
+                    last_checkpoint = now;
+                }
+            }
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The final state, so a finished render can later be continued to more samples
+    if (!options.checkpoint.empty()) {
+        checkpoints.Wait();
+        Checkpoint checkpoint;
+        checkpoint.Capture(tracer);
+        std::string error;
+        if (checkpoints.failed || !checkpoint.Write(options.checkpoint, error)) {
+            std::fprintf(stderr, "%s\n", checkpoints.failed ? checkpoints.error.c_str() : error.c_str());
+            return 1;
+        }
+    }
+
+    double denoise_seconds = 0.0;
+    if (options.denoise) {
+        const auto denoise_start = std::chrono::steady_clock::now();
+        tracer.Denoise();
+        denoise_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - denoise_start).count();
+    }
+    const std::vector<Color>& image = options.denoise ? tracer.denoised : tracer.pixels;
+
+    std::vector<Color> tonemapped;
+    tracer.Tonemap(tonemapped);
+
+    const std::string pfm_path = options.output + ".pfm";
+    const std::string ppm_path = options.output + ".ppm";
+    if (!WritePFM(pfm_path, options.width, options.height, image) || !WritePPM(ppm_path, options.width, options.height, tonemapped)) {
+        std::fprintf(stderr, "failed to write %s / %s\n", pfm_path.c_str(), ppm_path.c_str());
+        return 1;
+    }
+
+    const PathCounters counters = tracer.Counters();
+    const uint64_t rays = counters.rays + counters.shadow_rays;
+    std::printf("%dx%d, %d spp, %u workers, %s kernels\n", options.width, options.height, tracer.samples, tracer.pool.size(), cpu::isa_name(cpu::isa));
+    if (listener.valid()) {
+        std::printf("farm: %d workers, %zu items\n", coordinator.workers_seen, coordinator.items.size());
+    }
+    if (tracer.adaptive.enabled) {
+        std::printf("adaptive: %.1f%% of tiles converged\n", tracer.ConvergedFraction() * 100.0f);
+    }
+    std::printf("wall time: %.3f s\n", seconds);
+    if (options.denoise) {
+        std::printf("denoise: %.3f s\n", denoise_seconds);
+    }
+    std::printf("rays: %llu (%.3f Mrays/s)\n", (unsigned long long)rays, rays / seconds * 1e-6);
+    std::printf("  path rays: %llu, shadow rays: %llu, roulette terminations: %llu\n", (unsigned long long)counters.rays,
+                (unsigned long long)counters.shadow_rays, (unsigned long long)counters.roulette_kills);
+    std::printf("  intersection tests: %llu (%.2f per ray)\n", (unsigned long long)counters.intersection_tests,
+                double(counters.intersection_tests) / std::max<uint64_t>(rays, 1));
+
+    if (!options.trace.empty()) {
+        if (!tracer.profiler.WriteChromeTrace(options.trace)) {
+            std::fprintf(stderr, "failed to write %s\n", options.trace.c_str());
+            return 1;
+        }
+        std::printf("wrote trace %s\n", options.trace.c_str());
+    }
+
+    if (!options.reference.empty()) {
+        std::vector<Color> reference;
+        int ref_width, ref_height;
+        if (!ReadPFM(options.reference, ref_width, ref_height, reference) || ref_width != options.width || ref_height != options.height) {
+            std::fprintf(stderr, "reference %s is missing or has a different size\n", options.reference.c_str());
+            return 1;
+        }
+
+        // Error over time tells how long a configuration needs to reach a given quality
+        const float rmse = RMSE(tracer.pixels, reference);
+        std::printf("rmse: %.6f, rmse^2 * time: %.6f\n", rmse, rmse * rmse * seconds);
+        if (options.denoise) {
+            std::printf("denoised rmse: %.6f\n", RMSE(tracer.denoised, reference));
+        }
+    }
+
+    std::printf("wrote %s and %s\n", pfm_path.c_str(), ppm_path.c_str());
+}